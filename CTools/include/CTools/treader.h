@@ -11,9 +11,16 @@
 #ifdef _WIN32
 typedef HANDLE thread_t;
 typedef HANDLE mutex_t;
+typedef HANDLE semaphore_t;
 #else
 typedef pthread_t thread_t;
 typedef pthread_mutex_t mutex_t;
+// Unnamed POSIX semaphores aren't available everywhere (macOS), so it's a counter behind a condition
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int count;
+} semaphore_t;
 #endif
 
 // Define the unified functions
@@ -27,6 +34,10 @@ int mutex_init(mutex_t *mutex);
 int mutex_lock(mutex_t *mutex);
 int mutex_unlock(mutex_t *mutex);
 int mutex_destory(mutex_t *mutex);
+int semaphore_init(semaphore_t *semaphore, unsigned int count);
+int semaphore_wait(semaphore_t *semaphore);
+int semaphore_post(semaphore_t *semaphore);
+int semaphore_destroy(semaphore_t *semaphore);
 
 #ifdef __cplusplus
 }
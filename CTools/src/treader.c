@@ -30,6 +30,23 @@ int mutex_destroy(mutex_t *mutex) {
     return CloseHandle(*mutex) == 0 ? -1 : 0;
 }
 
+int semaphore_init(semaphore_t *semaphore, unsigned int count) {
+    *semaphore = CreateSemaphore(NULL, (LONG)count, MAXLONG, NULL);
+    return *semaphore == NULL ? -1 : 0;
+}
+
+int semaphore_wait(semaphore_t *semaphore) {
+    return WaitForSingleObject(*semaphore, INFINITE) == WAIT_FAILED ? -1 : 0;
+}
+
+int semaphore_post(semaphore_t *semaphore) {
+    return ReleaseSemaphore(*semaphore, 1, NULL) == 0 ? -1 : 0;
+}
+
+int semaphore_destroy(semaphore_t *semaphore) {
+    return CloseHandle(*semaphore) == 0 ? -1 : 0;
+}
+
 #else
 
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg) {
@@ -56,4 +73,36 @@ int mutex_destroy(mutex_t *mutex) {
     return pthread_mutex_destroy(mutex);
 }
 
+int semaphore_init(semaphore_t *semaphore, unsigned int count) {
+    semaphore->count = count;
+    if (pthread_mutex_init(&semaphore->mutex, NULL) != 0) {
+        return -1;
+    } else if (pthread_cond_init(&semaphore->cond, NULL) != 0) {
+        pthread_mutex_destroy(&semaphore->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+int semaphore_wait(semaphore_t *semaphore) {
+    pthread_mutex_lock(&semaphore->mutex);
+    while (semaphore->count == 0) {
+        pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+    }
+    semaphore->count--;
+    return pthread_mutex_unlock(&semaphore->mutex);
+}
+
+int semaphore_post(semaphore_t *semaphore) {
+    pthread_mutex_lock(&semaphore->mutex);
+    semaphore->count++;
+    pthread_cond_signal(&semaphore->cond);
+    return pthread_mutex_unlock(&semaphore->mutex);
+}
+
+int semaphore_destroy(semaphore_t *semaphore) {
+    pthread_cond_destroy(&semaphore->cond);
+    return pthread_mutex_destroy(&semaphore->mutex);
+}
+
 #endif
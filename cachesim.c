@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <unistd.h>
+  #include <limits.h>
+  #define MAX_PATH PATH_MAX
+#endif
+
+#include "putils.h"
+#include "pconstants.h"
+#include "CTools/treader.h"
+
+// Replays a trace written with record-trace= against many cache configurations at once,
+// the configurations are independent so every core takes the next one that is left
+
+#define MAX_SIMULATIONS 64
+#define NEVER UINT64_MAX
+
+typedef struct {
+    Cache *cache; // Geometry, plus the replacement state unless it is optimal
+    bool is_optimal; // Belady: evict the line used again furthest in the future
+    uint64_t read_misses;
+    uint64_t write_misses;
+} Simulation;
+
+typedef struct {
+    const uint32_t *addresses;
+    const uint8_t *is_write;
+    uint64_t count;
+    uint64_t *next_uses[MAX_LINE_WORDS]; // Per line bits, index of the next access to the same line
+    Simulation *simulations;
+    uint8_t simulation_count;
+    uint8_t next_simulation;
+    mutex_t mutex;
+} Replay;
+
+static uint32_t get_core_count(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+    #else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (uint32_t)cores : 1;
+    #endif
+}
+
+// One backward pass, the last access to every line points at the one after it
+static uint64_t *build_next_uses(const Replay *replay, uint8_t line_bits, uint32_t max_address) {
+    uint64_t line_count = ((uint64_t)max_address >> line_bits) + 1;
+    uint64_t *next_uses = malloc(replay->count * sizeof(uint64_t));
+    uint64_t *last_seen = malloc(line_count * sizeof(uint64_t));
+    if (!next_uses || !last_seen) {
+        perror("Failed to allocate memory for the next use index");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t line = 0; line < line_count; line++) {
+        last_seen[line] = NEVER;
+    }
+    for (uint64_t i = replay->count; i-- > 0;) {
+        uint32_t line = replay->addresses[i] >> line_bits;
+        next_uses[i] = last_seen[line];
+        last_seen[line] = i;
+    }
+    free(last_seen);
+    return next_uses;
+}
+
+// Belady's MIN with demand fills, every miss is installed like in the real cache
+static void run_optimal(const Replay *replay, Simulation *simulation) {
+    Cache *cache = simulation->cache;
+    const uint64_t *next_uses = replay->next_uses[cache->line_bits];
+    uint64_t slot_next_uses[MAX_CACHE_SIZE];
+    uint32_t slot_lines[MAX_CACHE_SIZE];
+    uint64_t valid_mask = 0;
+    for (uint64_t i = 0; i < replay->count; i++) {
+        uint32_t line = replay->addresses[i] >> cache->line_bits;
+        uint8_t first_slot = (line & ((1 << cache->set_bits) - 1)) << cache->way_bits;
+        uint8_t victim = first_slot;
+        bool is_hit = false;
+        for (uint8_t slot = first_slot; slot < first_slot + cache->ways; slot++) {
+            if ((valid_mask >> slot) & 1 && slot_lines[slot] == line) {
+                victim = slot;
+                is_hit = true;
+                break;
+            }
+        }
+        for (uint8_t slot = first_slot; !is_hit && slot < first_slot + cache->ways; slot++) {
+            if (!((valid_mask >> slot) & 1)) {
+                victim = slot; // Empty ways are filled first
+                break;
+            } else if (slot_next_uses[slot] > slot_next_uses[victim]) {
+                victim = slot;
+            }
+        }
+        record_cache_access(cache, replay->addresses[i], is_hit); // Against the same fully associative LRU as the other policies
+        if (!is_hit) {
+            simulation->read_misses += !replay->is_write[i];
+            simulation->write_misses += replay->is_write[i];
+        }
+        slot_lines[victim] = line;
+        slot_next_uses[victim] = next_uses[i];
+        valid_mask |= 1ULL << victim;
+    }
+}
+
+static void run_simulation(const Replay *replay, Simulation *simulation) {
+    if (simulation->is_optimal) {
+        run_optimal(replay, simulation);
+        return;
+    }
+    for (uint64_t i = 0; i < replay->count; i++) {
+        if (!access_cache_tags(simulation->cache, replay->addresses[i])) {
+            simulation->read_misses += !replay->is_write[i];
+            simulation->write_misses += replay->is_write[i];
+        }
+    }
+}
+
+static void *replay_worker(void *arg) {
+    Replay *replay = arg;
+    while (1) {
+        mutex_lock(&replay->mutex);
+        uint8_t index = replay->next_simulation;
+        replay->next_simulation += index < replay->simulation_count;
+        mutex_unlock(&replay->mutex);
+        if (index == replay->simulation_count) {
+            return NULL;
+        }
+        run_simulation(replay, &replay->simulations[index]);
+    }
+}
+
+// Takes the same list as shadow-caches=, opt in the policy field selects Belady's optimal replacement
+static uint8_t create_simulations(const char *spec, Simulation *simulations) {
+    uint8_t count = 0;
+    const char *cursor = spec;
+    while (*cursor) {
+        char item[64];
+        size_t length = strcspn(cursor, ",");
+        if (length >= sizeof(item)) {
+            fprintf(stderr, "Passed cache configuration is too long '%s'.\n", cursor);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(item, cursor, length);
+        item[length] = '\0';
+        cursor += length + (cursor[length] == ',');
+
+        // The third field is the policy, opt replays the geometry with its own bookkeeping
+        char *policy = strchr(item, ':');
+        policy = policy ? strchr(policy + 1, ':') : NULL;
+        bool is_optimal = policy && strncmp(policy + 1, "opt", 3) == 0 && (policy[4] == ':' || policy[4] == '\0');
+        if (is_optimal) {
+            memcpy(policy + 1, "lru", 3);
+        }
+        Cache *caches[MAX_SIMULATIONS];
+        uint8_t created = create_caches_from_spec(item, MIN_LINE_WORDS, caches, MAX_SIMULATIONS - count);
+        for (uint8_t i = 0; i < created; i++) {
+            simulations[count].cache = caches[i];
+            simulations[count].is_optimal = is_optimal;
+            simulations[count].read_misses = 0;
+            simulations[count].write_misses = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    char trace_path[MAX_PATH] = "";
+    char spec[MAX_PATH] = "";
+    uint32_t thread_count = 0;
+    bool help = false;
+    ParseableArgument arguments[] = {
+        {"help", "h", &help, strtobool, false},
+        {"caches=", "c=", &spec, strtostr, false},
+        {"threads=", "t=", &thread_count, strtou32, false},
+        {"", "", &trace_path, strtostr, false}, // Positional argument
+    };
+    int num_arguments = sizeof(arguments) / sizeof(ParseableArgument);
+    if (parse_arguments(argc, argv, arguments, num_arguments) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    if (help || trace_path[0] == '\0' || spec[0] == '\0') {
+        printf("pasm-cachesim Help Menu ~Flags~:\n");
+        printf("  help [h]                           : Opens this menu.\n");
+        printf("  caches [c]={bits[-bits][:ways[:policy[:line_words]]],...} : Cache configurations to replay, policy is one of lru;plru;fifo;random;opt.\n");
+        printf("  threads [t]={>0}                   : Sets the worker threads, the default is one per core.\n");
+        printf("  {positional_arg}                   : The trace file written with record-trace=.\n");
+        return help ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Replay replay = {0};
+    Simulation simulations[MAX_SIMULATIONS];
+    uint32_t *addresses;
+    uint8_t *is_write;
+    replay.count = read_trace(trace_path, &addresses, &is_write);
+    replay.addresses = addresses;
+    replay.is_write = is_write;
+    replay.simulations = simulations;
+    replay.simulation_count = create_simulations(spec, simulations);
+
+    // The seen lines bitmap only needs the highest address, there is no RAM behind the tags
+    uint32_t max_address = 0;
+    for (uint64_t i = 0; i < replay.count; i++) {
+        if (addresses[i] > max_address) max_address = addresses[i];
+    }
+    for (uint8_t i = 0; i < replay.simulation_count; i++) {
+        Cache *cache = simulations[i].cache;
+        attach_cache_ram(cache, NULL, (uint64_t)max_address + 1, 1);
+        if (simulations[i].is_optimal && !replay.next_uses[cache->line_bits]) {
+            replay.next_uses[cache->line_bits] = build_next_uses(&replay, cache->line_bits, max_address);
+        }
+    }
+
+    if (thread_count == 0) thread_count = get_core_count();
+    if (thread_count > replay.simulation_count) thread_count = replay.simulation_count;
+    thread_t threads[MAX_SIMULATIONS];
+    mutex_init(&replay.mutex);
+    for (uint32_t i = 0; i < thread_count; i++) {
+        if (thread_create(&threads[i], replay_worker, &replay) != 0) {
+            fprintf(stderr, "Failed to start replay thread %u.\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        thread_join(threads[i]);
+    }
+
+    printf("Replayed %" PRIu64 " data accesses on %u threads\n", replay.count, thread_count);
+    for (uint8_t i = 0; i < replay.simulation_count; i++) {
+        const Cache *cache = simulations[i].cache;
+        char name[32];
+        snprintf(name, sizeof(name), "%u:%u:%s:%u", cache->cache_bits, cache->fully_associative ? 0 : cache->ways,
+                 simulations[i].is_optimal ? "opt" : REPLACEMENT_POLICIES[cache->policy], cache->line_words);
+        print_cache_counters(name, &cache->counters);
+        printf("%-8s  %" PRIu64 " read misses, %" PRIu64 " write misses\n", "", simulations[i].read_misses, simulations[i].write_misses);
+        free_cache(simulations[i].cache);
+    }
+    for (uint8_t line_bits = 0; line_bits < MAX_LINE_WORDS; line_bits++) {
+        free(replay.next_uses[line_bits]);
+    }
+    free(addresses);
+    free(is_write);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include <gtk/gtk.h>
 #include <stdbool.h>
+#include <inttypes.h>
 
 #include "gtkgui.h"
 #include "CTools/treader.h"
@@ -15,10 +16,14 @@ static GtkWidget *start_stop_button = NULL;
 static GtkWidget *single_step_checkbox = NULL;
 GtkWidget *left_grid = NULL;
 GtkWidget *right_upper_grid = NULL;
+GtkWidget *l2_cache_grid = NULL;
 GtkWidget *cell_1_entry = NULL;
 GtkWidget *cell_2_entry = NULL;
 GtkWidget *cell_3_entry = NULL;
 GtkWidget *accumulator = NULL;
+GtkWidget *cache_stats_label = NULL;
+GtkWidget *timing_label = NULL;
+GtkWidget *pipeline_label = NULL;
 size_t previous_slot_index = (size_t)-1;
 
 static void on_ia_help(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
@@ -393,6 +398,21 @@ static void on_activate(GtkApplication *app, gpointer user_data) {
     gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(right_upper_scroll), right_upper_grid);
     gtk_box_append(GTK_BOX(right_panel), right_upper_scroll);
 
+    // Right Middle: L2 cache grid, shows the state of the loaded file
+    GtkWidget *l2_cache_scroll = gtk_scrolled_window_new();
+    gtk_widget_set_hexpand(l2_cache_scroll, TRUE);
+    gtk_widget_set_vexpand(l2_cache_scroll, TRUE);
+
+    l2_cache_grid = gtk_grid_new();
+    label = gtk_label_new("No L2 cache.");
+    gtk_grid_attach(GTK_GRID(l2_cache_grid), label, 0, 0, 1, 1);
+    gtk_widget_set_name(l2_cache_grid, "grid");
+    gtk_widget_set_hexpand(l2_cache_grid, TRUE);
+    gtk_widget_set_vexpand(l2_cache_grid, TRUE);
+
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(l2_cache_scroll), l2_cache_grid);
+    gtk_box_append(GTK_BOX(right_panel), l2_cache_scroll);
+
     // Right Lower Half: Controls
     GtkWidget *right_lower_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
     gtk_widget_set_hexpand(right_lower_box, TRUE);
@@ -435,6 +455,18 @@ static void on_activate(GtkApplication *app, gpointer user_data) {
     accumulator = gtk_label_new("Accumulator: 0");
     gtk_box_append(GTK_BOX(right_lower_box), accumulator);
 
+    // Cache statistics of the last run
+    cache_stats_label = gtk_label_new("Hits: 0 Misses: 0");
+    gtk_box_append(GTK_BOX(right_lower_box), cache_stats_label);
+
+    // Estimated runtime of the last run
+    timing_label = gtk_label_new("Cycles: 0 CPI: 0.00");
+    gtk_box_append(GTK_BOX(right_lower_box), timing_label);
+
+    // Stage view of the pipeline mode, empty without it
+    pipeline_label = gtk_label_new("");
+    gtk_box_append(GTK_BOX(right_lower_box), pipeline_label);
+
     // Buttons (Start/Step/Stop and Reset)
     GtkWidget *button_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
     start_stop_button = gtk_button_new_with_label("Start (Ctrl+g)"); // Step (Ctrl+s)
@@ -562,6 +594,56 @@ static void on_activate(GtkApplication *app, gpointer user_data) {
     g_object_unref(menu_item_app_help);
 }
 
+// Every row is one set, or one line for multi-word lines, single-word entries are wrapped into two columns
+static int get_cache_columns(const Cache *cache) {
+    int lines_per_row = cache->ways > 1 && !cache->fully_associative ? cache->ways : (cache->line_words > 1 ? 1 : 2);
+    return lines_per_row * cache->line_words;
+}
+
+static void format_cache_word(char *buffer, size_t buffer_size, const Cache *cache, uint16_t index, const char *state, uint32_t address, int32_t operand) {
+    uint8_t slot = index >> cache->line_bits;
+    uint8_t word = index & (cache->line_words - 1);
+    if (cache->ways > 1 && !cache->fully_associative && cache->line_words > 1) {
+        snprintf(buffer, buffer_size, "{%d.%d.%d|%s}: [%u] %d", slot >> cache->way_bits, slot & (cache->ways - 1), word, state, address, operand);
+    } else if (cache->ways > 1 && !cache->fully_associative) {
+        snprintf(buffer, buffer_size, "{%d.%d|%s}: [%u] %d", slot >> cache->way_bits, slot & (cache->ways - 1), state, address, operand);
+    } else if (cache->line_words > 1) {
+        snprintf(buffer, buffer_size, "{%d.%d|%s}: [%u] %d", slot, word, state, address, operand);
+    } else {
+        snprintf(buffer, buffer_size, "{%d|%s}: [%u] %d", slot, state, address, operand);
+    }
+}
+
+static void render_cache_grid(GtkWidget *grid, const Cache *cache) {
+    uint16_t cache_words = (uint16_t)cache->size << cache->line_bits;
+
+    for (uint16_t i = 0; i < cache_words; i++) {
+        // Extract cache information
+        uint32_t stored_address, operand;
+        bool is_dirty;
+        read_cache_word(cache, i, &stored_address, &operand, &is_dirty);
+
+        // Format cache entry string
+        char cache_entry_str[64];
+        format_cache_word(cache_entry_str, sizeof(cache_entry_str), cache, i, is_dirty ? "D" : "C", stored_address, (int32_t)operand);
+
+        // Create a new label for the cache entry
+        GtkWidget *label = gtk_label_new(cache_entry_str);
+        gtk_widget_set_name(label, "grid-cell");
+        gtk_widget_set_margin_top(label, 5);
+        gtk_widget_set_margin_bottom(label, 5);
+        gtk_widget_set_margin_start(label, 10);
+        gtk_widget_set_margin_end(label, 10);
+
+        // Determine the row and column for this cache entry
+        int row = i / get_cache_columns(cache);
+        int col = i % get_cache_columns(cache);
+
+        // Attach the label to the grid
+        gtk_grid_attach(GTK_GRID(grid), label, col, row, 1, 1);
+    }
+}
+
 void highlight_cell(GtkWidget *grid, size_t new_slot_index, size_t *previous_slot_index) {
     GtkWidget *current_child = gtk_widget_get_first_child(grid);
     GtkWidget *new_target_label = NULL;
@@ -661,42 +743,21 @@ static gboolean main_loop_update(gpointer user_data) {
             gtk_widget_queue_draw(GTK_WIDGET(left_grid));
             clear_grid(GTK_WIDGET(right_upper_grid));
             Cache *cache = backend_bridge->sdata_cell_cache;
-            if (!cache || !cache->entries) {
+            if (!cache || !cache->operands) {
                 GtkWidget *label = gtk_label_new("Cache is not initialized.");
                 gtk_grid_attach(GTK_GRID(right_upper_grid), label, 0, 0, 1, 1);
             } else {
-                uint8_t cache_size = cache->size;
-
-                for (uint8_t i = 0; i < cache_size; i++) {
-                    uint64_t entry = cache->entries[i];
-
-                    // Extract cache information
-                    bool is_dirty = entry & (1ULL << 32);
-                    uint32_t stored_address = (uint32_t)((entry >> (32 + cache->cache_bits)) << cache->cache_bits);
-                    int32_t operand = (int32_t)(entry & 0xFFFFFFFF);
-
-                    // Format cache entry string
-                    char cache_entry_str[64];
-                    snprintf(cache_entry_str, sizeof(cache_entry_str), "{%d|%s}: [%u] %d", 
-                            i, is_dirty ? "D" : "C", stored_address | i, operand);
-
-                    // Create a new label for the cache entry
-                    GtkWidget *label = gtk_label_new(cache_entry_str);
-                    gtk_widget_set_name(label, "grid-cell");
-                    gtk_widget_set_margin_top(label, 5);
-                    gtk_widget_set_margin_bottom(label, 5);
-                    gtk_widget_set_margin_start(label, 10);
-                    gtk_widget_set_margin_end(label, 10);
-
-                    // Determine the row and column for this cache entry
-                    int row = i / 2;
-                    int col = i % 2;
-
-                    // Attach the label to the grid
-                    gtk_grid_attach(GTK_GRID(right_upper_grid), label, col, row, 1, 1);
-                }
+                render_cache_grid(right_upper_grid, cache);
             }
             gtk_widget_queue_draw(GTK_WIDGET(right_upper_grid));
+            clear_grid(GTK_WIDGET(l2_cache_grid));
+            if (!cache || !cache->next_level) {
+                GtkWidget *label = gtk_label_new("No L2 cache.");
+                gtk_grid_attach(GTK_GRID(l2_cache_grid), label, 0, 0, 1, 1);
+            } else {
+                render_cache_grid(l2_cache_grid, cache->next_level);
+            }
+            gtk_widget_queue_draw(GTK_WIDGET(l2_cache_grid));
         }
         backend_bridge->gui_interrupt_code = IC_NOTHING;
     }
@@ -713,12 +774,40 @@ static gboolean main_loop_update(gpointer user_data) {
     snprintf(accumulator_str, sizeof(accumulator_str), "ACCU: %d", *backend_bridge->accumulator);
     gtk_label_set_text(GTK_LABEL(accumulator), accumulator_str);
 
+    const CacheCounters *counters = &backend_bridge->cache_counters;
+    char cache_stats_str[128];
+    snprintf(cache_stats_str, sizeof(cache_stats_str), "Hits: %" PRIu64 " Misses: %" PRIu64 " (%" PRIu64 " comp. %" PRIu64 " cap. %" PRIu64 " conf.)",
+             counters->hits, counters->misses, counters->compulsory_misses, counters->capacity_misses, counters->conflict_misses);
+    gtk_label_set_text(GTK_LABEL(cache_stats_label), cache_stats_str);
+
+    char timing_str[64];
+    snprintf(timing_str, sizeof(timing_str), "Cycles: %" PRIu64 " CPI: %.2f", backend_bridge->cycles,
+             backend_bridge->timed_instructions ? (double)backend_bridge->cycles / backend_bridge->timed_instructions : 0.0);
+    gtk_label_set_text(GTK_LABEL(timing_label), timing_str);
+
+    const Pipeline *pipeline = backend_bridge->pipeline;
+    if (pipeline) {
+        char pipeline_str[192];
+        int length = 0;
+        for (uint8_t stage = 0; stage < PIPELINE_STAGES; stage++) {
+            if (pipeline->stage_pcs[stage] == PIPELINE_BUBBLE) {
+                length += snprintf(pipeline_str + length, sizeof(pipeline_str) - length, "%s: -  ", PIPELINE_STAGE_NAMES[stage]);
+            } else {
+                length += snprintf(pipeline_str + length, sizeof(pipeline_str) - length, "%s: [%u]  ", PIPELINE_STAGE_NAMES[stage], pipeline->stage_pcs[stage]);
+            }
+        }
+        snprintf(pipeline_str + length, sizeof(pipeline_str) - length, "\nStalls: %" PRIu64 " load-use %" PRIu64 " control %" PRIu64 " memory %" PRIu64 " execute",
+                 pipeline->load_use_stalls, pipeline->control_stalls, pipeline->memory_stalls, pipeline->execute_stalls);
+        gtk_label_set_text(GTK_LABEL(pipeline_label), pipeline_str);
+    }
+
     // Update from queue
     //
     while (!is_empty(backend_bridge->change_queue)) {
         uint64_t value_gotten;
         bool is_writeback = false;
-        dequeue_with_bit(backend_bridge->change_queue, &value_gotten, &is_writeback);
+        uint16_t cache_idx;
+        dequeue_with_slot(backend_bridge->change_queue, &value_gotten, &is_writeback, &cache_idx);
         if (is_writeback) {
             uint32_t address = (uint32_t)(value_gotten >> 32);
             int32_t operand = (int32_t)value_gotten;
@@ -737,18 +826,18 @@ static gboolean main_loop_update(gpointer user_data) {
                 g_print("Warning: Writeback address %u not found in left grid.\n", address);
             }
         } else {
-            uint8_t magic = 32 - backend_bridge->sdata_cell_cache->cache_bits;
-            uint8_t cache_idx = (uint8_t)((value_gotten << magic) >> magic + 32);
+            Cache *cache = backend_bridge->sdata_cell_cache;
+            uint32_t address = (uint32_t)(value_gotten >> 32);
             // printf("Idx %u\n", value_gotten);
             // printf("Idx %u\n", cache_idx);
             int32_t operand = (int32_t)value_gotten;
 
             // Format and update the label for the cache update
             char cache_update_str[64];
-            snprintf(cache_update_str, sizeof(cache_update_str), "{%d|%s}: [%u] %d", cache_idx, "U", cache_idx, operand);
+            format_cache_word(cache_update_str, sizeof(cache_update_str), cache, cache_idx, "U", address, operand);
 
-            int row = cache_idx / 2;
-            int col = cache_idx % 2;
+            int row = cache_idx / get_cache_columns(cache);
+            int col = cache_idx % get_cache_columns(cache);
 
             GtkWidget *label = gtk_grid_get_child_at(GTK_GRID(right_upper_grid), col, row);
             if (label) {
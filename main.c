@@ -87,10 +87,602 @@ int run_gui() {
     return EXIT_SUCCESS;
 }
 
+// The data cell cache, with an optional L2 behind it (0 L2 bits disable it)
+static Cache *create_data_cell_cache(uint8_t cache_bits, uint8_t cache_ways, uint8_t line_words, uint8_t cache_policy,
+                                     uint8_t l2_cache_bits, uint8_t l2_cache_ways, uint8_t l2_cache_policy, bool l2_exclusive,
+                                     uint8_t write_policy, bool write_allocate, uint8_t write_buffer_size, uint8_t prefetcher,
+                                     const char *shadow_caches, TraceWriter *trace, bool reuse_distance,
+                                     uint8_t cache_warmup, const WarmupProfile *warmup_profile) {
+    Cache *cache = create_cache(cache_bits, cache_ways, line_words, cache_policy);
+    if (l2_cache_bits > 0) {
+        attach_next_level(cache, create_cache(l2_cache_bits, l2_cache_ways, line_words, l2_cache_policy), l2_exclusive);
+    }
+    set_write_policy(cache, write_policy, write_allocate, write_buffer_size);
+    set_prefetcher(cache, prefetcher);
+    add_shadow_caches(cache, shadow_caches);
+    cache->trace = trace;
+    set_reuse_analyzer(cache, reuse_distance);
+    set_cache_warmup(cache, cache_warmup, warmup_profile);
+    return cache;
+}
+
+// Without cache simulation data cells are read and written in RAM directly, the cache stays as it was seeded
+static inline uint32_t load_data_cell(Cache *cache, uint8_t *ram, uint32_t address, uint8_t instruction_size, bool simulate_cache) {
+    if (simulate_cache) {
+        return get_u32_from_cache_or_ram(cache, ram, address, instruction_size);
+    }
+    uint64_t ram_index = (uint64_t)address * instruction_size;
+    uint32_t operand = 0;
+    if (ram[ram_index] != 0) {
+        fprintf(stderr, "\nTried to load non-data address at %u.\n", address);
+        free_cache(cache);
+        free_ram(ram);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(&operand, ram + ram_index + 1, instruction_size - 1);
+    return (uint32_t)sign_extend_i32(operand, instruction_size - 1);
+}
+
+// Returns whether the cache holds the stored word, a bypassed store reports its RAM write like a cache would
+static inline bool store_data_cell(Cache *cache, uint8_t *ram, uint32_t address, uint32_t operand, uint8_t instruction_size, bool simulate_cache) {
+    if (simulate_cache) {
+        return store_to_cache(cache, address, operand);
+    }
+    cache->evicted[0] = ((uint64_t)address << 32) | operand;
+    cache->evicted_count = 1;
+    writeback_cache_entry(cache, ram, cache->evicted[0], instruction_size);
+    return false;
+}
+
+// Stores a data cell and queues the RAM and cache words the GUI has to redraw
+static void store_queued_cell(Cache *cache, uint8_t *ram, Queue64 *queue, uint32_t address, int32_t operand, uint8_t instruction_size,
+                              bool simulate_cache, bool is_queue_drained) {
+    bool is_cached = store_data_cell(cache, ram, address, (uint32_t)operand, instruction_size, simulate_cache);
+    if (is_queue_drained && is_full(queue)) { // Nobody drains it without the GUI
+        printf("QUEUE FULL\n");
+        exit(1);
+    }
+    for (uint8_t i = 0; i < cache->evicted_count; i++) {
+        enqueue_with_bit(queue, cache->evicted[i], true);
+    }
+    if (is_cached) {
+        enqueue_with_slot(queue, (uint64_t)address << 32 | (uint32_t)operand, false, cache->last_word);
+    }
+}
+
+// *** Virtual memory ***
+
+// Data addresses are virtual, a two-level page table in guest RAM maps them to physical cells page by page.
+// Both levels are one page of PTE cells holding their frame + 1 (0 = not present), so p page bits give 3p address bits.
+// Pages are materialized on their first access: the pages of the file map to themselves, every other one gets a zeroed frame.
+// Instructions are fetched untranslated, they only live in the identity mapped file.
+typedef struct {
+    Cache *tlb; // Virtual page number -> frame, one word lines
+    uint8_t page_bits;
+    uint32_t root; // Frame of the root table
+    uint32_t image_pages; // Pages of the file, mapped to themselves
+    uint32_t next_frame; // Frames are handed out upwards from the end of the file
+    uint32_t frame_count; // Frames of physical RAM
+    uint64_t walks;
+    uint64_t walk_cycles;
+    uint64_t tables; // Second level tables created
+    uint64_t materialized; // Pages of the program that got their frame
+    // Where the walks load and store the PTEs, set when a file is loaded
+    uint8_t *ram;
+    uint8_t instruction_size;
+    bool simulate_cache;
+    Queue64 *queue;
+    bool is_queue_drained;
+    TimingModel *timing;
+} VirtualMemory;
+
+static void init_virtual_memory(VirtualMemory *vm, uint8_t page_bits, uint8_t tlb_bits, uint8_t tlb_ways) {
+    memset(vm, 0, sizeof(VirtualMemory));
+    vm->page_bits = page_bits;
+    vm->tlb = create_cache(tlb_bits, tlb_ways, 1, POLICY_LRU);
+}
+
+// The page table stays in RAM, the TLB starts cold again like the data cell cache
+static void reset_virtual_memory_stats(VirtualMemory *vm) {
+    reset_cache(vm->tlb);
+    vm->walks = 0;
+    vm->walk_cycles = 0;
+    vm->tables = 0;
+    vm->materialized = 0;
+}
+
+static uint32_t allocate_frame(VirtualMemory *vm) {
+    if (vm->next_frame == vm->root) vm->next_frame++;
+    if (vm->next_frame >= vm->frame_count) {
+        fprintf(stderr, "\nOut of physical memory after %u frames, raise it with overwrite-memory-size=.\n", vm->frame_count);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t cells = 1u << vm->page_bits;
+    memset(vm->ram + (uint64_t)vm->next_frame * cells * vm->instruction_size, 0, (size_t)cells * vm->instruction_size); // Never cached, nothing mapped it
+    return vm->next_frame++;
+}
+
+// Starts over with an empty page table in the given RAM, the root goes to page_table or the last frame
+static void attach_virtual_memory(VirtualMemory *vm, uint8_t *ram, uint64_t ram_size, uint64_t file_size, uint8_t instruction_size, uint32_t page_table,
+                                  bool simulate_cache, Queue64 *queue, bool is_queue_drained, TimingModel *timing) {
+    uint32_t cells = 1u << vm->page_bits;
+    uint64_t max_pte = ((uint64_t)1 << (8 * (instruction_size - 1) - 1)) - 1;
+    vm->ram = ram;
+    vm->instruction_size = instruction_size;
+    vm->simulate_cache = simulate_cache;
+    vm->queue = queue;
+    vm->is_queue_drained = is_queue_drained;
+    vm->timing = timing;
+    vm->frame_count = (uint32_t)(ram_size / instruction_size >> vm->page_bits);
+    vm->image_pages = (uint32_t)((file_size / instruction_size + cells - 1) >> vm->page_bits);
+    vm->next_frame = vm->image_pages;
+    vm->root = page_table == NO_PAGE_TABLE ? vm->frame_count - 1 : page_table >> vm->page_bits;
+    if (vm->frame_count == 0 || vm->frame_count > max_pte) {
+        fprintf(stderr, "%u frames of %u cells can't be mapped with %u byte operands.\n", vm->frame_count, cells, instruction_size - 1);
+        exit(EXIT_FAILURE);
+    } else if (page_table == NO_PAGE_TABLE && vm->frame_count <= vm->image_pages) {
+        fprintf(stderr, "No frame is left after the file for the page table, raise the RAM with overwrite-memory-size=.\n");
+        exit(EXIT_FAILURE);
+    } else if ((page_table != NO_PAGE_TABLE && page_table & (cells - 1)) || vm->root < vm->image_pages || vm->root >= vm->frame_count) {
+        fprintf(stderr, "The page table has to be a page aligned cell between the file and the end of RAM (%u:%u).\n",
+                vm->image_pages << vm->page_bits, (vm->frame_count - 1) << vm->page_bits);
+        exit(EXIT_FAILURE);
+    }
+    memset(ram + ((uint64_t)vm->root << vm->page_bits) * instruction_size, 0, (size_t)cells * instruction_size);
+    reset_virtual_memory_stats(vm);
+}
+
+// Follows one PTE, a missing one is filled with a fresh frame (or the file page itself at the last level)
+static uint32_t walk_level(VirtualMemory *vm, Cache *cache, uint32_t pte_address, uint32_t identity_frame, uint64_t *filled) {
+    uint32_t entry = load_data_cell(cache, vm->ram, pte_address, vm->instruction_size, vm->simulate_cache);
+    vm->timing->data_loads++;
+    if (entry == 0) {
+        entry = (identity_frame != UINT32_MAX ? identity_frame : allocate_frame(vm)) + 1;
+        store_queued_cell(cache, vm->ram, vm->queue, pte_address, (int32_t)entry, vm->instruction_size, vm->simulate_cache, vm->is_queue_drained);
+        vm->timing->data_stores++;
+        (*filled)++;
+    }
+    return entry - 1;
+}
+
+// The physical cell behind a virtual data address
+static uint32_t translate_address(VirtualMemory *vm, Cache *cache, uint32_t address) {
+    uint8_t page_bits = vm->page_bits;
+    uint32_t page = address >> page_bits;
+    if (page >> (2 * page_bits)) {
+        fprintf(stderr, "\nAddress %u is outside of the %u bit virtual address space.\n", address, 3 * page_bits);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t entry = find_in_cache(vm->tlb, page);
+    if (entry > UINT32_MAX) {
+        uint64_t cycles = get_cycles(vm->timing, vm->simulate_cache ? cache : NULL);
+        uint32_t table = walk_level(vm, cache, (vm->root << page_bits) | (page >> page_bits), UINT32_MAX, &vm->tables);
+        entry = walk_level(vm, cache, (table << page_bits) | (page & ((1u << page_bits) - 1)), page < vm->image_pages ? page : UINT32_MAX,
+                           &vm->materialized);
+        vm->walks++;
+        vm->walk_cycles += get_cycles(vm->timing, vm->simulate_cache ? cache : NULL) - cycles;
+    }
+    add_to_cache(vm->tlb, page, (uint32_t)entry, false); // Counts the hit or miss
+    return ((uint32_t)entry << page_bits) | (address & ((1u << page_bits) - 1));
+}
+
+static inline uint32_t translate_data_address(VirtualMemory *vm, Cache *cache, uint32_t address) {
+    return vm->tlb ? translate_address(vm, cache, address) : address;
+}
+
+static void print_virtual_memory_stats(const VirtualMemory *vm) {
+    const CacheCounters *counters = &vm->tlb->counters;
+    uint64_t accesses = counters->hits + counters->misses;
+    uint32_t free_frames = vm->frame_count - vm->next_frame - (vm->root >= vm->next_frame);
+    printf("%-8s: %" PRIu64 " hits, %" PRIu64 " misses, %.2f%% hit rate (%u entries, %u ways), %" PRIu64 " page walks costing %" PRIu64 " cycles\n",
+           "TLB", counters->hits, counters->misses, accesses ? 100.0 * counters->hits / accesses : 0.0, vm->tlb->size, vm->tlb->ways, vm->walks, vm->walk_cycles);
+    printf("%-8s: %" PRIu64 " pages materialized, %" PRIu64 " page tables created, %u of %u frames free (%u cells per page)\n", "Paging",
+           vm->materialized, vm->tables, free_frames, vm->frame_count, 1u << vm->page_bits);
+}
+
+static void print_ram_listing(const uint8_t *ram, uint64_t file_size, uint8_t instruction_size, uint8_t operand_size) {
+    size_t ram_index = 0;
+    while (ram_index < file_size) {
+        // Ensure there is enough space for a full instruction
+        if (ram_index + instruction_size > file_size) {
+            fprintf(stderr, "Incomplete instruction at offset %zu. Skipping.\n", ram_index);
+            break;
+        }
+
+        uint8_t opcode = ram[ram_index];
+        uint32_t operand = 0;
+        int32_t signed_operand = 0;
+
+        if (opcode == 0) {
+            // Opcode 0: Use sign-extended operand
+            signed_operand = sign_extend_i32((uint32_t)ram[ram_index + 1], operand_size);
+        } else {
+            // Normal unsigned operand
+            memcpy(&operand, ram + ram_index + 1, operand_size);
+        }
+
+        // Get instruction name
+        const char *instruction_name = (opcode < 99) ? INSTRUCTION_SET[opcode] : "UNKNOWN";
+
+        // Print instruction
+        if (opcode == 0) {
+            printf("Instruction: %-7s Operand: %i (Signed)\n", instruction_name, signed_operand);
+        } else {
+            printf("Instruction: %-7s Operand: %u (Unsigned)\n", instruction_name, operand);
+        }
+
+        // Move to the next instruction
+        ram_index += instruction_size;
+    }
+}
+
+static void release_live_view(uint8_t **vram, Cache **vdata_cell_cache) {
+    free(*vram);
+    free_cache(*vdata_cell_cache);
+    *vram = NULL;
+    *vdata_cell_cache = NULL;
+}
+
+// *** Instruction set ***
+
+// Outcomes of execute_instruction
+#define STEP_NEXT 0
+#define STEP_STOP 1 // Reached STP, the counter stays on it
+#define STEP_FAULT 2 // The memory refused a load or store and reported why
+#define STEP_DIVIDE_BY_ZERO 3
+#define STEP_UNKNOWN_OPCODE 4
+
+// The data cells a core works on, a load returns the cell as its cache holds it
+typedef struct {
+    void *memory;
+    bool (*load)(void *memory, uint32_t address, uint32_t *value);
+    bool (*store)(void *memory, uint32_t address, int32_t value);
+    uint8_t operand_size;
+} CellPort;
+
+// What the instruction went through, for the single-step output
+typedef struct {
+    uint32_t pointer; // Cell address an indirect instruction loaded
+    int32_t value; // Operand an arithmetic instruction loaded
+} StepDetail;
+
+// Has to hold before an opcode is timed or executed, execute_instruction rejects the others as well
+static bool is_known_opcode(uint8_t op_code) {
+    return op_code != NOP && op_code < OPCODE_COUNT && INSTRUCTION_SET[op_code];
+}
+
+static bool is_jump_taken(uint8_t op_code, int32_t accumulator) {
+    switch (op_code) {
+        case JNZ_DIR:
+        case JNZ_IND:
+            return accumulator != 0;
+        case JZE_DIR:
+        case JZE_IND:
+            return accumulator == 0;
+        case JLE_DIR:
+        case JLE_IND:
+            return accumulator <= 0;
+        default:
+            return true; // JMP
+    }
+}
+
+// The semantics of every instruction, for p_program and the harts alike. instruction_counter already points past
+// the instruction, a taken jump replaces it.
+static uint8_t execute_instruction(uint8_t op_code, uint32_t operand, int32_t *accumulator, uint32_t *instruction_counter,
+                                   const CellPort *port, StepDetail *detail) {
+    uint32_t value;
+    *detail = (StepDetail){0};
+    switch (op_code) {
+        case LDA_IMM:
+            *accumulator = sign_extend_i32(operand, port->operand_size);
+            return STEP_NEXT;
+        case LDA_DIR:
+            if (!port->load(port->memory, operand, &value)) return STEP_FAULT;
+            *accumulator = sign_extend_i32(value, port->operand_size);
+            return STEP_NEXT;
+        case LDA_IND:
+            if (!port->load(port->memory, operand, &detail->pointer) || !port->load(port->memory, detail->pointer, &value)) return STEP_FAULT;
+            *accumulator = sign_extend_i32(value, port->operand_size);
+            return STEP_NEXT;
+        case STA_DIR:
+            return port->store(port->memory, operand, *accumulator) ? STEP_NEXT : STEP_FAULT;
+        case STA_IND:
+            return port->load(port->memory, operand, &detail->pointer) && port->store(port->memory, detail->pointer, *accumulator) ? STEP_NEXT : STEP_FAULT;
+        case ADD_DIR:
+        case SUB_DIR:
+        case MUL_DIR:
+        case DIV_DIR:
+            if (!port->load(port->memory, operand, &value)) return STEP_FAULT;
+            detail->value = sign_extend_i32(value, port->operand_size);
+            if (op_code == ADD_DIR) {
+                *accumulator += detail->value;
+            } else if (op_code == SUB_DIR) {
+                *accumulator -= detail->value;
+            } else if (op_code == MUL_DIR) {
+                *accumulator *= detail->value;
+            } else if (detail->value == 0) {
+                return STEP_DIVIDE_BY_ZERO;
+            } else {
+                *accumulator /= detail->value;
+            }
+            return STEP_NEXT;
+        case JMP_DIR:
+        case JNZ_DIR:
+        case JZE_DIR:
+        case JLE_DIR:
+            if (is_jump_taken(op_code, *accumulator)) *instruction_counter = operand;
+            return STEP_NEXT;
+        case JMP_IND:
+        case JNZ_IND:
+        case JZE_IND:
+        case JLE_IND:
+            if (!port->load(port->memory, operand, &detail->pointer)) return STEP_FAULT;
+            if (is_jump_taken(op_code, *accumulator)) *instruction_counter = detail->pointer;
+            return STEP_NEXT;
+        case STP:
+            (*instruction_counter)--;
+            return STEP_STOP;
+        default:
+            return STEP_UNKNOWN_OPCODE;
+    }
+}
+
+// The data cells of p_program, a failing load exits in load_data_cell itself
+typedef struct {
+    Cache *cache;
+    uint8_t *ram;
+    VirtualMemory *vm;
+    Queue64 *change_queue;
+    uint8_t instruction_size;
+    bool simulate_cache;
+    bool is_queue_drained;
+} CoreMemory;
+
+static bool load_core_cell(void *memory, uint32_t address, uint32_t *value) {
+    CoreMemory *core = memory;
+    *value = load_data_cell(core->cache, core->ram, translate_data_address(core->vm, core->cache, address), core->instruction_size, core->simulate_cache);
+    return true;
+}
+
+static bool store_core_cell(void *memory, uint32_t address, int32_t value) {
+    CoreMemory *core = memory;
+    // The cache writes to RAM itself according to its write policy
+    store_queued_cell(core->cache, core->ram, core->change_queue, translate_data_address(core->vm, core->cache, address), value, core->instruction_size,
+                      core->simulate_cache, core->is_queue_drained);
+    return true;
+}
+
+// The single-step output: the instruction, then the cells it went through
+static void describe_instruction(uint8_t op_code, uint32_t operand, int32_t accumulator, uint32_t pc, const StepDetail *detail,
+                                 char *instruction, char *coinstruction, char *cocoinstruction, size_t size) {
+    snprintf(instruction, size, "[%u] %s %u", pc, INSTRUCTION_SET[op_code], operand);
+    coinstruction[0] = '\0';
+    cocoinstruction[0] = '\0';
+    switch (op_code) {
+        case LDA_IMM:
+            snprintf(instruction, size, "[%u] LDA_IMM #%i", pc, accumulator);
+            break;
+        case LDA_DIR:
+        case STA_DIR:
+            snprintf(coinstruction, size, "[%u] %i", operand, accumulator);
+            break;
+        case LDA_IND:
+        case STA_IND:
+            snprintf(coinstruction, size, "[%u] %u", operand, detail->pointer);
+            snprintf(cocoinstruction, size, "[%u] %i", detail->pointer, accumulator);
+            break;
+        case ADD_DIR:
+        case SUB_DIR:
+        case MUL_DIR:
+        case DIV_DIR:
+            snprintf(coinstruction, size, "[%u] %i", operand, detail->value);
+            break;
+        case JMP_IND:
+        case JNZ_IND:
+        case JZE_IND:
+        case JLE_IND:
+            snprintf(coinstruction, size, "[%u] %u", operand, detail->pointer);
+            break;
+        case STP:
+            snprintf(instruction, size, "[%u] STP", pc);
+            break;
+        default:
+            break;
+    }
+}
+
+// *** Harts ***
+
+// One guest core, all harts share RAM and keep their private caches coherent
+typedef struct {
+    uint8_t id;
+    uint32_t instruction_counter;
+    int32_t accumulator;
+    uint64_t executed;
+    Cache *cache;
+    uint8_t *ram;
+    uint64_t file_size;
+    uint64_t ram_size;
+    uint8_t operand_size;
+    TimingModel timing;
+    bool stopped; // Reached STP, otherwise it stopped on an error
+} Hart;
+
+static bool load_hart_cell(void *memory, uint32_t address, uint32_t *operand) {
+    Hart *hart = memory;
+    uint8_t instruction_size = hart->operand_size + 1;
+    if ((uint64_t)address * instruction_size + instruction_size > hart->ram_size || hart->ram[(uint64_t)address * instruction_size] != 0) {
+        fprintf(stderr, "\nHart %u tried to load non-data address at %u.\n", hart->id, address);
+        return false;
+    }
+    *operand = coherent_load(hart->cache, address);
+    return true;
+}
+
+// Harts fetch instruction cells straight from RAM without the bus, so write-backs may only ever reach data cells
+static bool store_hart_cell(void *memory, uint32_t address, int32_t value) {
+    Hart *hart = memory;
+    uint8_t instruction_size = hart->operand_size + 1;
+    if ((uint64_t)address * instruction_size + instruction_size > hart->ram_size) {
+        fprintf(stderr, "\nHart %u tried to store outside of RAM at %u.\n", hart->id, address);
+        return false;
+    } else if (hart->ram[(uint64_t)address * instruction_size] != 0) {
+        fprintf(stderr, "\nHart %u tried to store to non-data address at %u.\n", hart->id, address);
+        return false;
+    }
+    coherent_store(hart->cache, address, (uint32_t)value);
+    return true;
+}
+
+// Runs execute_instruction like p_program, without the GUI and the single-step output
+static void *run_hart(void *arg) {
+    Hart *hart = arg;
+    uint8_t instruction_size = hart->operand_size + 1;
+    CellPort port = {hart, load_hart_cell, store_hart_cell, hart->operand_size};
+    StepDetail detail;
+    while (true) {
+        uint64_t program_counter = (uint64_t)hart->instruction_counter * instruction_size;
+        if (program_counter + instruction_size > hart->file_size) {
+            fprintf(stderr, "Hart %u reached end of file during execution at %u.\n", hart->id, hart->instruction_counter);
+            return NULL;
+        }
+        uint8_t op_code = hart->ram[program_counter];
+        if (!is_known_opcode(op_code)) {
+            fprintf(stderr, "Hart %u tried to execute unknown opcode (%u) at %u.\n", hart->id, op_code, hart->instruction_counter);
+            return NULL;
+        }
+        uint32_t operand = 0;
+        memcpy(&operand, hart->ram + program_counter + 1, hart->operand_size);
+        uint32_t current_pc = hart->instruction_counter++;
+        set_access_context(hart->cache, current_pc, op_code);
+        time_instruction(&hart->timing, op_code);
+        hart->executed++;
+        uint8_t step = execute_instruction(op_code, operand, &hart->accumulator, &hart->instruction_counter, &port, &detail);
+        if (step == STEP_STOP) {
+            hart->stopped = true;
+            return NULL;
+        } else if (step == STEP_DIVIDE_BY_ZERO) {
+            fprintf(stderr, "Hart %u divided by zero at %u.\n", hart->id, current_pc);
+            return NULL;
+        } else if (step != STEP_NEXT) {
+            return NULL; // The port reported the fault
+        }
+    }
+}
+
+// Parses entries like "0,40,80", one per hart, every hart starts at 0 without them
+static void parse_hart_entries(const char *entries, Hart *harts, uint8_t hart_count) {
+    const char *cursor = entries;
+    uint8_t count = 0;
+    while (*cursor) {
+        char *end;
+        unsigned long entry = strtoul(cursor, &end, 10);
+        if (end == cursor || (*end != ',' && *end != '\0') || entry > UINT32_MAX || count == hart_count) {
+            fprintf(stderr, "Passed hart entries '%s' have to be %u addresses separated by commas.\n", entries, hart_count);
+            exit(EXIT_FAILURE);
+        }
+        harts[count++].instruction_counter = (uint32_t)entry;
+        cursor = end + (*end == ',');
+    }
+    if (count != 0 && count != hart_count) {
+        fprintf(stderr, "Passed hart entries '%s' have to be %u addresses separated by commas.\n", entries, hart_count);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Runs one image on several harts over one RAM, every hart has its own data cell cache kept coherent with MESI
+static int run_harts(char *script_path, char *input_file, uint8_t hart_count, const char *hart_entries,
+                     uint8_t cache_bits, uint8_t cache_ways, uint8_t line_words, uint8_t cache_policy,
+                     const char *shadow_caches, bool reuse_distance, const char *timing_path) {
+    if (!ends_with(input_file, ".p")) {
+        fprintf(stderr, "Usage: %s [arguments] <file>.p\n", script_path);
+        return EXIT_FAILURE;
+    }
+    char absolute_path[PATH_MAX];
+    if (realpath(input_file, absolute_path) == NULL) {
+        perror("realpath");
+        return EXIT_FAILURE;
+    }
+    Cache *caches[MAX_HARTS];
+    Hart harts[MAX_HARTS] = {0};
+    TimingModel timing;
+    init_timing(&timing, timing_path);
+    for (uint8_t i = 0; i < hart_count; i++) {
+        // Harts start cold, a seeded line would have to be shared by all of them
+        caches[i] = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, 0, 1, POLICY_LRU, false, WRITE_BACK, true, 0,
+                                           PREFETCH_NONE, shadow_caches, NULL, reuse_distance, WARMUP_COLD, NULL);
+    }
+    uint64_t file_size;
+    uint32_t memory_size;
+    uint8_t operand_size;
+    printf("Running: %s on %u harts\n", absolute_path, hart_count);
+    uint8_t *ram = read_file(absolute_path, caches[0], &file_size, &memory_size, &operand_size);
+    uint8_t instruction_size = 1 + operand_size;
+    uint64_t ram_size = ((uint64_t)memory_size + 1) * instruction_size;
+    ram_size = ram_size > file_size ? ram_size : file_size;
+    for (uint8_t i = 0; i < hart_count; i++) {
+        attach_cache_ram(caches[i], ram, ram_size, instruction_size);
+        harts[i].id = i;
+        harts[i].cache = caches[i];
+        harts[i].ram = ram;
+        harts[i].file_size = file_size;
+        harts[i].ram_size = ram_size;
+        harts[i].operand_size = operand_size;
+        harts[i].timing = timing;
+    }
+    parse_hart_entries(hart_entries, harts, hart_count);
+    CoherenceBus *bus = create_coherence_bus(caches, hart_count);
+
+    thread_t threads[MAX_HARTS];
+    for (uint8_t i = 0; i < hart_count; i++) {
+        if (thread_create(&threads[i], run_hart, &harts[i]) != 0) {
+            fprintf(stderr, "Failed to start hart %u.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uint8_t i = 0; i < hart_count; i++) {
+        thread_join(threads[i]);
+    }
+
+    // The harts are done, their dirty lines can go to RAM in any order, MESI left at most one modified copy
+    Queue64 writebacks;
+    init_queue(&writebacks, MAX_CACHE_SIZE * MAX_LINE_WORDS + 1);
+    int exit_code = EXIT_SUCCESS;
+    for (uint8_t i = 0; i < hart_count; i++) {
+        Hart *hart = &harts[i];
+        printf("\nHart %u: %s at %u after %" PRIu64 " instructions, ACC %i\n", i, hart->stopped ? "STP" : "stopped", hart->instruction_counter,
+               hart->executed, hart->accumulator);
+        flush_cache(hart->cache, &writebacks);
+        reset_queue(&writebacks);
+        print_cache_stats(hart->cache);
+        print_coherence_stats(hart->cache);
+        print_timing(&hart->timing, hart->cache);
+        if (hart->cache->reuse) {
+            print_reuse_histogram(hart->cache->reuse, hart->cache->line_words);
+        }
+        exit_code = hart->stopped ? exit_code : EXIT_FAILURE;
+    }
+    print_ram_listing(ram, file_size, instruction_size, operand_size);
+
+    free_coherence_bus(bus);
+    free_queue(&writebacks);
+    for (uint8_t i = 0; i < hart_count; i++) {
+        free_cache(caches[i]);
+    }
+    free_ram(ram);
+    return exit_code;
+}
+
 int p_program(char *script_path, bool disable_gui, bool single_step_mode, 
               uint32_t overwrite_memory_size, uint8_t overwrite_operand_size, 
-              char *input_file, uint8_t cache_bits, uint8_t queue_size, 
-              bool immidiate_start, bool single_loop) 
+              char *input_file, uint8_t cache_bits, uint8_t cache_ways, uint8_t line_words, uint8_t cache_policy, 
+              uint8_t l2_cache_bits, uint8_t l2_cache_ways, uint8_t l2_cache_policy, bool l2_exclusive, 
+              uint8_t write_policy, bool write_allocate, uint8_t write_buffer_size, uint8_t prefetcher, 
+              const char *shadow_caches, const char *trace_path, bool reuse_distance, const char *reuse_json, bool rewarm_cache_lines, bool simulate_cache, 
+              uint8_t cache_warmup, const char *warmup_profile_path, const char *timing_path, bool pipeline_mode, uint8_t predictor_kind, uint8_t history_bits, 
+              bool virtual_memory, uint8_t page_bits, uint32_t page_table, uint8_t tlb_bits, uint8_t tlb_ways, 
+              uint8_t icache_bits, uint8_t icache_ways, uint8_t icache_line_words, uint8_t icache_policy, bool unified_cache, uint8_t queue_size, bool immidiate_start, bool single_loop) 
 {
     // printf("disable_gui: %s\n", disable_gui ? "true" : "false");
     // printf("single_step_mode: %s\n", single_step_mode ? "true" : "false");
@@ -103,18 +695,15 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
     char coinstruction[20] = {0};
     char cocoinstruction[20] = {0};
     uint32_t instruction_counter = 0;
+    uint32_t current_pc; // Address of the executing instruction, instruction_counter already points past it
     uint64_t program_counter = 0;
     int32_t accumulator = 0;
-    uint32_t temp_u32;
-    uint64_t temp_u64;
-    int32_t temp_i32;
     uint8_t temp_u8;
     uint8_t op_code;
     uint32_t operand;
     bool running = true;
     bool executing = false;
     bool peek = false;
-    bool is_valid_result;
 
     // Uninitialized vars
     uint64_t file_size;
@@ -123,17 +712,31 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
     uint8_t operand_size;
     uint8_t instruction_size;
     uint8_t *ram = NULL, *sram = NULL, *temp_ram = NULL;
+    uint8_t *vram = NULL; // Live view handed to the GUI after a cache change
+    Cache *vdata_cell_cache = NULL;
+    Cache *temp_cache = NULL;
+    TraceWriter *trace = trace_path[0] != '\0' ? open_trace(trace_path) : NULL;
+    WarmupProfile *warmup_profile = cache_warmup == WARMUP_PROFILE ? load_warmup_profile(warmup_profile_path) : NULL;
+    TimingModel timing;
+    init_timing(&timing, timing_path);
+    Pipeline pipeline = {0};
+    pipeline.predictor = predictor_kind <= MAX_PREDICTOR ? create_branch_predictor(predictor_kind, history_bits) : NULL;
+    reset_pipeline(&pipeline);
+    VirtualMemory vm = {0};
+    if (virtual_memory) {
+        init_virtual_memory(&vm, page_bits, tlb_bits, tlb_ways);
+    }
+    Cache *icache = icache_bits > 0 ? create_cache(icache_bits, icache_ways, icache_line_words, icache_policy) : NULL; // Split, tags only
 
-    Cache *data_cell_cache = create_cache(cache_bits);
+    Cache *data_cell_cache = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, write_allocate, write_buffer_size, prefetcher, shadow_caches, trace, reuse_distance || reuse_json[0] != '\0', cache_warmup, warmup_profile);
     Cache *sdata_cell_cache = NULL;
     Queue64 change_queue;
-    if (!disable_gui) {
-        init_queue(&change_queue, queue_size);
-    }
+    init_queue(&change_queue, queue_size); // Also without the GUI, flushes and stores queue their writebacks into it
 
     Bridge gui_bridge; // Will be here even without gui for easier integration
     init_bridge(&gui_bridge, &accumulator, &instruction_size, &instruction_counter, instruction, coinstruction, cocoinstruction, 
                 &executing, &single_step_mode, &change_queue, data_cell_cache, sdata_cell_cache, NULL, NULL, 0);
+    gui_bridge.pipeline = pipeline_mode ? &pipeline : NULL;
     
     // Set bridge code to open a file
     if (input_file[0] != '\0') {
@@ -167,13 +770,13 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 if (data_cell_cache != NULL) {
                     reset_cache(data_cell_cache);
                 } else {
-                    data_cell_cache = create_cache(cache_bits);
+                    data_cell_cache = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, write_allocate, write_buffer_size, prefetcher, shadow_caches, trace, reuse_distance || reuse_json[0] != '\0', cache_warmup, warmup_profile);
                 }
                 if (sdata_cell_cache != NULL) {
                     free_cache(sdata_cell_cache);
                 }
-                if (ram != NULL) free(ram);
-                if (sram != NULL) free(sram);
+                if (ram != NULL) free_ram(ram);
+                if (sram != NULL) free_ram(sram);
                 
                 if (!ends_with(gui_bridge.new_file_str, ".p")) {
                     fprintf(stderr, "Usage: %s [arguments] <file>.p\n", script_path);
@@ -197,6 +800,8 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 instruction_counter = 0;
                 program_counter = 0;
                 accumulator = 0;
+                reset_timing(&timing);
+                reset_pipeline(&pipeline);
 
                 if (overwrite_memory_size > 0) {
                     if (overwrite_memory_size > MAX_MEMORY_SIZE || overwrite_memory_size < MIN_MEMORY_SIZE) {
@@ -207,11 +812,11 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                         exit(EXIT_FAILURE);
                     }
                     memory_size = overwrite_memory_size;
-                    ram_size = memory_size * instruction_size;
-                    temp_ram = realloc(ram, file_size);
+                    ram_size = (uint64_t)memory_size * instruction_size;
+                    temp_ram = resize_ram(ram, file_size, ram_size > file_size ? ram_size : file_size);
                     if (!temp_ram) {
                         perror("Failed to allocate ram");
-                        free(ram);
+                        free_ram(ram);
                         free_cache(data_cell_cache);
                         // free(gui_bridge);
                         gtkgui_stop();
@@ -219,14 +824,12 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                     }
                     ram = temp_ram;
                     temp_ram = NULL;
-                    if (ram_size > file_size) {
-                        memset(ram + file_size, 0, ram_size - file_size);
-                    }
+                    attach_cache_ram(data_cell_cache, ram, ram_size > file_size ? ram_size : file_size, instruction_size);
                 }
                 if (overwrite_operand_size > 0) {
                     if (overwrite_operand_size > MAX_OPERAND_SIZE || overwrite_operand_size < MIN_OPERAND_SIZE) {
                         printf("The operant size %u is not in range (%u:%u).", overwrite_operand_size, MIN_OPERAND_SIZE, MAX_OPERAND_SIZE);
-                        free(ram);
+                        free_ram(ram);
                         free_cache(data_cell_cache);
                         // free(gui_bridge);
                         gtkgui_stop();
@@ -234,27 +837,34 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                     }
                     operand_size = overwrite_operand_size;
                 }
+                if (vm.tlb) {
+                    attach_virtual_memory(&vm, ram, data_cell_cache->ram_size, file_size, instruction_size, page_table, simulate_cache, &change_queue, !disable_gui, &timing);
+                }
+                if (icache) { // No RAM, only the seen lines of the code for the miss classification
+                    attach_cache_ram(icache, NULL, file_size, instruction_size);
+                    reset_cache(icache);
+                }
 
                 mutex_lock(gui_bridge.mutex);
-                sram = malloc(ram_size);
+                sram = duplicate_ram(ram, ram_size);
                 if (!sram) {
                     perror("Failed to allocate sram");
-                    free(ram);
+                    free_ram(ram);
                     free_cache(data_cell_cache);
                     exit(EXIT_FAILURE);
                 }
-                memcpy(sram, ram, ram_size);
                 sdata_cell_cache = duplicate_cache(data_cell_cache);
                 if (!sdata_cell_cache) {
                     perror("Failed to allocate sdata_cell_cache");
-                    free(ram);
-                    free(sram);
+                    free_ram(ram);
+                    free_ram(sram);
                     free_cache(data_cell_cache);
                     exit(EXIT_FAILURE);
                 }
 
                 gui_bridge.sdata_cell_cache = sdata_cell_cache;
                 gui_bridge.sram = sram;
+                release_live_view(&vram, &vdata_cell_cache);
                 gui_bridge.sram_size = ram_size;
 
                 gui_bridge.backend_interrupt_code = IC_NOTHING;
@@ -279,11 +889,11 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 operand_size = 0;
                 instruction_size = 0;
                 if (ram != NULL) {
-                    free(ram);
+                    free_ram(ram);
                     ram = NULL;
                 }
                 if (sram != NULL) {
-                    free(sram);
+                    free_ram(sram);
                     sram = NULL;
                 }
                 temp_ram = NULL;
@@ -296,11 +906,12 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                     free_cache(sdata_cell_cache);
                 }
 
-                data_cell_cache = create_cache(cache_bits);
+                data_cell_cache = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, write_allocate, write_buffer_size, prefetcher, shadow_caches, trace, reuse_distance || reuse_json[0] != '\0', cache_warmup, warmup_profile);
                 sdata_cell_cache = NULL;
 
                 gui_bridge.sdata_cell_cache = sdata_cell_cache;
                 gui_bridge.sram = sram;
+                release_live_view(&vram, &vdata_cell_cache);
                 gui_bridge.sram_size = ram_size;
 
                 // Empty queue
@@ -315,28 +926,67 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 mutex_unlock(gui_bridge.mutex);
                 break;
             case BIC_CHANGE_CACHE_BITS:
-                if (data_cell_cache != NULL) {
-                    free(data_cell_cache);
-                }
                 mutex_lock(gui_bridge.mutex);
-                if (sdata_cell_cache != NULL) {
-                    free_cache(sdata_cell_cache);
+                gui_bridge.backend_interrupt_code = IC_NOTHING;
+                if (gui_bridge.new_cache_bits > MAX_CACHE_BITS || gui_bridge.new_cache_bits < MIN_CACHE_BITS) {
+                    printf("The cache bits %u is not in range (%u:%u).\n", gui_bridge.new_cache_bits, MIN_CACHE_BITS, MAX_CACHE_BITS);
+                    mutex_unlock(gui_bridge.mutex);
+                    break;
                 }
                 cache_bits = gui_bridge.new_cache_bits;
-                if (cache_bits > MAX_CACHE_BITS || cache_bits < MIN_CACHE_BITS) {
-                    printf("The cache bits %u is not in range (%u:%u).\n", operand_size, MIN_CACHE_BITS, MAX_CACHE_BITS);
-                    free(ram);
-                    if (sram) {
-                        free(sram);
-                    }
+                if (cache_ways > (1 << cache_bits)) {
+                    cache_ways = 0; // There can't be more ways than entries, so keep a single set
+                    printf("Cache is now fully associative.\n");
+                }
+                temp_cache = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, write_allocate, write_buffer_size, prefetcher, shadow_caches, trace, reuse_distance || reuse_json[0] != '\0', cache_warmup, warmup_profile);
+                if (ram == NULL) { // Nothing loaded, nothing to carry over
+                    free_cache(data_cell_cache);
+                    data_cell_cache = temp_cache;
+                    temp_cache = NULL;
+                    printf("Changed cache bits to %u.\n", cache_bits);
+                    mutex_unlock(gui_bridge.mutex);
+                    break;
+                }
+
+                // The running program keeps its RAM, the dirty words of the old geometry go there first
+                print_cache_stats(data_cell_cache);
+                flush_cache(data_cell_cache, &change_queue);
+                attach_cache_ram(temp_cache, ram, data_cell_cache->ram_size, instruction_size);
+                if (gui_bridge.new_cache_rewarm || rewarm_cache_lines) {
+                    rewarm_cache(temp_cache, data_cell_cache);
+                }
+                move_cache_observers(temp_cache, data_cell_cache);
+                set_access_context(temp_cache, data_cell_cache->access_pc, data_cell_cache->access_opcode);
+                if (simulate_cache) {
+                    retire_cache_timing(&timing, data_cell_cache); // The estimate spans every geometry the run went through
+                }
+                free_cache(data_cell_cache);
+                data_cell_cache = temp_cache;
+
+                // Reset goes back to the loaded file, seeded into the new geometry like on open
+                free_cache(sdata_cell_cache);
+                sdata_cell_cache = create_data_cell_cache(cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, write_allocate, write_buffer_size, prefetcher, shadow_caches, NULL, false, cache_warmup, warmup_profile);
+                seed_cache(sdata_cell_cache, sram, ram_size, (uint32_t)(file_size / instruction_size), instruction_size, NULL);
+                attach_cache_ram(sdata_cell_cache, ram, data_cell_cache->ram_size, instruction_size);
+
+                // The GUI redraws from a snapshot of the live state instead of the loaded one
+                release_live_view(&vram, &vdata_cell_cache);
+                vram = malloc(ram_size);
+                vdata_cell_cache = duplicate_cache(data_cell_cache);
+                if (!vram || !vdata_cell_cache) {
+                    perror("Failed to allocate the live view");
                     exit(EXIT_FAILURE);
                 }
-                executing = false;
-                data_cell_cache = create_cache(cache_bits);
-                // sdata_cell_cache = duplicate_cache(data_cell_cache);
-                gui_bridge.backend_interrupt_code = BIC_OPEN_FILE;
-                printf("Changed cache bits to %u.\nReloading file from disk ...\n", cache_bits);
-                continue;
+                memcpy(vram, ram, ram_size);
+                gui_bridge.sdata_cell_cache = vdata_cell_cache;
+                gui_bridge.sram = vram;
+                gui_bridge.sram_size = ram_size;
+                reset_queue(&change_queue);
+                if (gui_bridge.gui_interrupt_code == IC_NOTHING) {
+                    gui_bridge.gui_interrupt_code = GIC_RESET;
+                }
+                temp_cache = NULL;
+                printf("Changed cache bits to %u, continuing at %u.\n", cache_bits, instruction_counter);
                 mutex_unlock(gui_bridge.mutex);
                 break;
             case BIC_START_STEP_BUTTON:
@@ -352,6 +1002,8 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                     executing = true;
                     instruction_counter = 0;
                     reset_queue(&change_queue);
+                    reset_timing(&timing);
+                    reset_pipeline(&pipeline);
                     accumulator = 0;
                     gui_bridge.backend_interrupt_code = IC_NOTHING;
                     mutex_unlock(gui_bridge.mutex);
@@ -362,19 +1014,28 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 printf("Resetting state from loaded file ...\n");
                 mutex_lock(gui_bridge.mutex);
                 memcpy(ram, sram, ram_size);
+                if (vm.tlb) { // Back to the empty page table of the loaded file
+                    attach_virtual_memory(&vm, ram, data_cell_cache->ram_size, file_size, instruction_size, page_table, simulate_cache, &change_queue, !disable_gui, &timing);
+                }
                 if (sdata_cell_cache != NULL) {
                     free_cache(data_cell_cache);
                     data_cell_cache = duplicate_cache(sdata_cell_cache);
+                    data_cell_cache->trace = trace; // The snapshot neither records nor analyzes
+                    set_reuse_analyzer(data_cell_cache, reuse_distance || reuse_json[0] != '\0');
                 } else if (data_cell_cache != NULL) reset_cache(data_cell_cache);
+                if (icache) reset_cache(icache);
                 instruction[0] = '\0';
                 coinstruction[0] = '\0';
                 cocoinstruction[0] = '\0';
                 instruction_counter = 0;
                 program_counter = 0;
                 executing = false;
+                reset_timing(&timing);
+                reset_pipeline(&pipeline);
 
                 gui_bridge.sdata_cell_cache = sdata_cell_cache;
                 gui_bridge.sram = sram;
+                release_live_view(&vram, &vdata_cell_cache);
                 gui_bridge.sram_size = ram_size;
                 reset_queue(&change_queue);
 
@@ -409,232 +1070,96 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 printf("AKKU: %i\n", accumulator);
             }
             op_code = ram[program_counter++];
-            instruction_counter++;
-            if (op_code >= 10 && op_code <= 99) {
+            current_pc = instruction_counter++;
+            if (simulate_cache) {
+                set_access_context(data_cell_cache, instruction_counter - 1, op_code);
+            }
+            if (icache) {
+                timing.fetch_misses += !fetch_instruction(icache, current_pc);
+            } else if (unified_cache && simulate_cache) {
+                fetch_instruction(data_cell_cache, current_pc);
+            }
+            if (is_known_opcode(op_code)) {
                 if (program_counter + operand_size <= file_size) {
                     operand = 0;
                     memcpy(&operand, ram + program_counter, operand_size);
                     program_counter += operand_size;
+                    time_instruction(&timing, op_code);
                     // printf("%u u%d i%d\n", op_code, address_op, data_op);
                 } else {
                     fprintf(stderr, "Reached end of file during execution at %u.\n", instruction_counter);
-                    free(ram);
+                    free_ram(ram);
                     free_cache(data_cell_cache);
                     return EXIT_FAILURE;
                 }
-                switch (op_code) {
-                    case LDA_IMM:
-                        accumulator = sign_extend_i32(operand, operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] LDA_IMM #%i", instruction_counter - 1, accumulator);
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case LDA_DIR:
-                        temp_i32 = (int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size);
-                        accumulator = sign_extend_i32(temp_i32, operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] LDA_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, accumulator);
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case LDA_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] LDA_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size); // First level: Load the indirect address
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        temp_i32 = (int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, temp_u32, instruction_size); // Second level: Load the value at the indirect address
-                        accumulator = sign_extend_i32(temp_i32, operand_size); // Store the final value in the accumulator
-                        snprintf(cocoinstruction, sizeof(cocoinstruction), "[%u] %i", temp_u32, accumulator);
-                        break;
-                    case STA_DIR:
-                        // if address 0 writes back 0 we have a lot of trouble
-                        temp_u64 = add_to_cache(data_cell_cache, operand, (uint32_t)accumulator, true, &is_valid_result);
-                        if (is_full(&change_queue)) {
-                            printf("QUEUE FULL\n");
-                            exit(1);
-                        }
-                        if (is_valid_result) {
-                            writeback_cache_entry(data_cell_cache, ram, temp_u64, instruction_size);
-                            enqueue_with_bit(&change_queue, temp_u64, true);
-                        }
-                        // printf("Queuing1 %u\n", operand);
-                        // printf("Making1 %u\n", (uint64_t)operand << 32 | accumulator);
-                        enqueue_with_bit(&change_queue, (uint64_t)operand << 32 | accumulator, false);
-                        snprintf(instruction, sizeof(instruction), "[%u] STA_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, accumulator);
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case STA_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] STA_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size); // First level: Load the indirect address
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        // if address 0 writes back 0 we have a lot of trouble
-                        temp_u64 = add_to_cache(data_cell_cache, temp_u32, (uint32_t)accumulator, true, &is_valid_result);
-                        if (is_full(&change_queue)) {
-                            printf("QUEUE FULL\n");
-                            exit(1);
-                        }
-                        if (is_valid_result) {
-                            writeback_cache_entry(data_cell_cache, ram, temp_u64, instruction_size);
-                            enqueue_with_bit(&change_queue, temp_u64, true);
-                        }
-                        // printf("Queuing2 %u\n", temp_u32);
-                        enqueue_with_bit(&change_queue, (uint64_t)temp_u32 << 32 | accumulator, false);
-                        snprintf(cocoinstruction, sizeof(cocoinstruction), "[%u] %i", temp_u32, accumulator);
-                        break;
-                    case ADD_DIR:
-                        temp_i32 = sign_extend_i32((int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size), operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] ADD_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, temp_i32);
-                        cocoinstruction[0] = '\0';
-                        accumulator += temp_i32, operand_size;
-                        break;
-                    case SUB_DIR:
-                        temp_i32 = sign_extend_i32((int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size), operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] SUB_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, temp_i32);
-                        cocoinstruction[0] = '\0';
-                        accumulator -= temp_i32;
-                        break;
-                    case MUL_DIR:
-                        temp_i32 = sign_extend_i32((int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size), operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] MUL_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, temp_i32);
-                        cocoinstruction[0] = '\0';
-                        accumulator *= temp_i32;
-                        break;
-                    case DIV_DIR:
-                        temp_i32 = sign_extend_i32((int32_t)get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size), operand_size);
-                        snprintf(instruction, sizeof(instruction), "[%u] DIV_DIR %u", instruction_counter - 1, operand);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %i", operand, temp_i32);
-                        cocoinstruction[0] = '\0';
-                        accumulator /= temp_i32;
-                        break;
-                    case JMP_DIR:
-                        instruction_counter = operand;
-                        program_counter = instruction_counter * instruction_size;
-                        snprintf(instruction, sizeof(instruction), "[%u] JMP_DIR %u", instruction_counter - 1, operand);
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case JMP_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] JMP_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        cocoinstruction[0] = '\0';
-                        instruction_counter = temp_u32;
-                        program_counter = instruction_counter * instruction_size;
-                        break;
-                    case JNZ_DIR:
-                        if (accumulator != 0) {
-                            instruction_counter = operand;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        snprintf(instruction, sizeof(instruction), "[%u] JNZ_DIR %u", instruction_counter - 1, operand);
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case JNZ_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] JNZ_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        cocoinstruction[0] = '\0';
-                        if (accumulator != 0) {
-                            instruction_counter = temp_u32;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        break;
-                    case JZE_DIR:
-                        if (accumulator == 0) {
-                            instruction_counter = operand;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        snprintf(instruction, sizeof(instruction), "[%u] JZE_DIR %u", instruction_counter - 1, operand);
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case JZE_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] JZE_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        cocoinstruction[0] = '\0';
-                        if (accumulator == 0) {
-                            instruction_counter = temp_u32;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        break;
-                    case JLE_DIR:
-                        if (accumulator <= 0) {
-                            instruction_counter = operand;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        snprintf(instruction, sizeof(instruction), "[%u] JLE_DIR %u", instruction_counter - 1, operand);
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
-                        break;
-                    case JLE_IND:
-                        snprintf(instruction, sizeof(instruction), "[%u] JLE_IND %u", instruction_counter - 1, operand);
-                        temp_u32 = get_u32_from_cache_or_ram(data_cell_cache, ram, operand, instruction_size);
-                        snprintf(coinstruction, sizeof(coinstruction), "[%u] %u", operand, temp_u32);
-                        cocoinstruction[0] = '\0';
-                        if (accumulator <= 0) {
-                            instruction_counter = temp_u32;
-                            program_counter = instruction_counter * instruction_size;
-                        }
-                        break;
-                    case STP:
-                        executing = false;
-                        snprintf(instruction, sizeof(instruction), "[%u] STP", instruction_counter - 1);
-                        instruction_counter--;
-                        coinstruction[0] = '\0';
-                        cocoinstruction[0] = '\0';
+                CoreMemory memory = {data_cell_cache, ram, &vm, &change_queue, instruction_size, simulate_cache, !disable_gui};
+                CellPort port = {&memory, load_core_cell, store_core_cell, operand_size};
+                StepDetail detail;
+                uint8_t step = execute_instruction(op_code, operand, &accumulator, &instruction_counter, &port, &detail);
+                if (step == STEP_DIVIDE_BY_ZERO) {
+                    fprintf(stderr, "Divided by zero at %u.\n", current_pc);
+                    free_ram(ram);
+                    free_cache(data_cell_cache);
+                    return EXIT_FAILURE;
+                }
+                describe_instruction(op_code, operand, accumulator, current_pc, &detail, instruction, coinstruction, cocoinstruction, sizeof(instruction));
+                if (step == STEP_NEXT) {
+                    program_counter = (uint64_t)instruction_counter * instruction_size;
+                } else if (step == STEP_STOP) {
+                    executing = false;
+                    if (pipeline_mode) { // Before the flush, writing back the cache isn't part of the program
+                        pipeline_instruction(&pipeline, &timing, simulate_cache ? data_cell_cache : NULL, current_pc, op_code, current_pc + 1);
+                    }
+                    if (simulate_cache) {
                         print_cache(data_cell_cache);
-                        for (uint32_t index = 0; index < data_cell_cache->size; index++) {
-                            uint64_t entry = data_cell_cache->entries[index];
-
-                            // Extract the stored address
-                            uint32_t stored_address = (uint32_t)(entry >> (32 + data_cell_cache->cache_bits));
-                            uint32_t stored_operand = (uint32_t)entry;
-
-                            uint64_t actual_entry = ((uint64_t)((stored_address << data_cell_cache->cache_bits) | index) << 32) | stored_operand;
-                            writeback_cache_entry(data_cell_cache, ram, actual_entry, instruction_size);
-                            enqueue_with_bit(&change_queue, actual_entry, true);
-                        }
-                        reset_cache(data_cell_cache);
-                        size_t ram_index = 0;
-                        while (ram_index < file_size) {
-                            // Ensure there is enough space for a full instruction
-                            if (ram_index + instruction_size > file_size) {
-                                fprintf(stderr, "Incomplete instruction at offset %zu. Skipping.\n", ram_index);
-                                break;
-                            }
-
-                            uint8_t opcode = ram[ram_index];
-                            uint32_t operand = 0;
-                            int32_t signed_operand = 0;
-
-                            if (opcode == 0) {
-                                // Opcode 0: Use sign-extended operand
-                                signed_operand = sign_extend_i32((uint32_t)ram[ram_index + 1], operand_size);
-                            } else {
-                                // Normal unsigned operand
-                                memcpy(&operand, ram + ram_index + 1, operand_size);
-                            }
-
-                            // Get instruction name
-                            const char *instruction_name = (opcode < 99) ? INSTRUCTION_SET[opcode] : "UNKNOWN";
-
-                            // Print instruction
-                            if (opcode == 0) {
-                                printf("Instruction: %-7s Operand: %i (Signed)\n", instruction_name, signed_operand);
-                            } else {
-                                printf("Instruction: %-7s Operand: %u (Unsigned)\n", instruction_name, operand);
-                            }
-
-                            // Move to the next instruction
-                            ram_index += instruction_size;
+                        flush_cache(data_cell_cache, &change_queue);
+                        print_cache_stats(data_cell_cache);
+                    } else {
+                        printf("Cache simulation disabled, data cells went straight to RAM.\n");
+                    }
+                    if (icache) {
+                        print_icache_stats(icache);
+                        reset_cache(icache);
+                    }
+                    print_timing(&timing, simulate_cache ? data_cell_cache : NULL);
+                    if (pipeline_mode) {
+                        print_pipeline(&pipeline);
+                    }
+                    if (pipeline.predictor) {
+                        print_branch_stats(pipeline.predictor);
+                    }
+                    if (vm.tlb) {
+                        print_virtual_memory_stats(&vm);
+                        reset_virtual_memory_stats(&vm);
+                    }
+                    if (data_cell_cache->reuse) {
+                        print_reuse_histogram(data_cell_cache->reuse, data_cell_cache->line_words);
+                        if (reuse_json[0] != '\0' && write_reuse_json(data_cell_cache->reuse, data_cell_cache->line_words, reuse_json)) {
+                            printf("Reuse distances written to %s\n", reuse_json);
                         }
-                        break;
-                    default:
-                        break;
+                    }
+                    if (trace) {
+                        fflush(trace->file);
+                        printf("Trace: %" PRIu64 " data accesses recorded to %s\n", trace->records, trace_path);
+                    }
+                    mutex_lock(gui_bridge.mutex);
+                    gui_bridge.cache_counters = data_cell_cache->counters;
+                    memcpy(gui_bridge.cache_opcode_counters, data_cell_cache->opcode_counters, sizeof(gui_bridge.cache_opcode_counters));
+                    gui_bridge.cycles = get_cycles(&timing, simulate_cache ? data_cell_cache : NULL);
+                    gui_bridge.timed_instructions = timing.instructions;
+                    if (pipeline_mode) { // The pipeline replaces the simple estimate in the GUI
+                        gui_bridge.cycles = get_pipeline_cycles(&pipeline);
+                    }
+                    mutex_unlock(gui_bridge.mutex);
+                    reset_cache(data_cell_cache);
+                    reset_timing(&timing);
+                    reset_pipeline(&pipeline);
+                    print_ram_listing(ram, file_size, instruction_size, operand_size);
+                }
+                if (pipeline_mode && op_code != STP) {
+                    pipeline_instruction(&pipeline, &timing, simulate_cache ? data_cell_cache : NULL, current_pc, op_code, instruction_counter);
+                } else if (pipeline.predictor && is_predicted_jump(op_code)) {
+                    predict_branch(pipeline.predictor, current_pc, op_code, instruction_counter);
                 }
                 printf("%s (%s;%s)\n", instruction, coinstruction, cocoinstruction);
             } else {
@@ -642,12 +1167,12 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                     // program_counter += operand_size;
                     // continue;
                     fprintf(stderr, "Tried to execute unknown opcode (%u) at %u.\n", op_code, instruction_counter);
-                    free(ram);
+                    free_ram(ram);
                     free_cache(data_cell_cache);
                     return EXIT_FAILURE;
                 } else {
                     fprintf(stderr, "Reached end of file during execution at %u.\n", instruction_counter);
-                    free(ram);
+                    free_ram(ram);
                     free_cache(data_cell_cache);
                     return EXIT_FAILURE;
                 }
@@ -687,7 +1212,7 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 printf("  close          : Closes the currently loaded file\n");
                 printf("  start          : Starts execution of currently opened file.\n");
                 printf("  toggle         : Toggles single-step mode.\n");
-                printf("  cache [%u-%u]    : Changes the cache bits.\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+                printf("  cache [%u-%u] [warm] : Changes the cache bits, warm keeps the lines of the old cache.\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
                 printf("  exit           : Exits the program.\n");
                 printf("\n> ");
                 if (!fgets(command, sizeof(command), stdin)) {
@@ -741,7 +1266,8 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                 } else if (strcmp(command, "toggle") == 0) {
                     single_step_mode = !single_step_mode;
                 } else if (strncmp(command, "cache ", 6) == 0) {
-                    int bits = atoi(command + 6);
+                    char *bits_end;
+                    int bits = (int)strtol(command + 6, &bits_end, 10);
                     if (bits >= MIN_CACHE_BITS && bits <= MAX_CACHE_BITS) {
                         mutex_lock(gui_bridge.mutex);
                         if (gui_bridge.backend_interrupt_code == IC_NOTHING) {
@@ -751,6 +1277,8 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
                             break;
                         }
                         gui_bridge.new_cache_bits = (uint8_t)bits;
+                        bits_end += strspn(bits_end, " ");
+                        gui_bridge.new_cache_rewarm = strcmp(bits_end, "warm") == 0;
                         mutex_unlock(gui_bridge.mutex);
                         break;
                     } else {
@@ -781,10 +1309,16 @@ int p_program(char *script_path, bool disable_gui, bool single_step_mode,
     // print_buffer_in_hex(ram, file_size);
 
     if (!disable_gui) gtkgui_stop();
-    free(ram);
-    free(sram);
+    free_ram(ram);
+    free_ram(sram);
     free_cache(data_cell_cache);
     free_cache(sdata_cell_cache);
+    release_live_view(&vram, &vdata_cell_cache);
+    close_trace(trace);
+    free_warmup_profile(warmup_profile);
+    free_branch_predictor(pipeline.predictor);
+    free_cache(vm.tlb);
+    free_cache(icache);
     return EXIT_SUCCESS;
 }
 
@@ -808,6 +1342,41 @@ int main(int argc, char *argv[]) {
     uint8_t overwrite_operand_size = 0;
     char input_file[MAX_PATH] = "";
     uint8_t cache_bits = 4;
+    uint8_t cache_ways = 1;
+    uint8_t line_words = 1;
+    uint8_t cache_policy = POLICY_LRU;
+    uint8_t l2_cache_bits = 0;
+    uint8_t l2_cache_ways = 1;
+    uint8_t l2_cache_policy = POLICY_LRU;
+    bool l2_exclusive = false;
+    uint8_t write_policy = WRITE_BACK;
+    bool no_write_allocate = false;
+    uint8_t write_buffer_size = 0;
+    uint8_t prefetcher = PREFETCH_NONE;
+    char shadow_caches[MAX_PATH] = "";
+    char trace_path[MAX_PATH] = "";
+    bool reuse_distance = false;
+    char reuse_json[MAX_PATH] = "";
+    bool rewarm_cache_lines = false;
+    bool no_cache_sim = false;
+    uint8_t cache_warmup = WARMUP_LOAD;
+    char warmup_profile[MAX_PATH] = "";
+    char timing_path[MAX_PATH] = "";
+    bool pipeline_mode = false;
+    uint8_t predictor_kind = UINT8_MAX; // No predictor
+    uint8_t history_bits = 8;
+    bool virtual_memory = false;
+    uint8_t page_bits = 4;
+    uint32_t page_table = NO_PAGE_TABLE;
+    uint8_t tlb_bits = 3;
+    uint8_t tlb_ways = 0;
+    uint8_t icache_bits = 0;
+    uint8_t icache_ways = 1;
+    uint8_t icache_line_words = 4;
+    uint8_t icache_policy = POLICY_LRU;
+    bool unified_cache = false;
+    uint8_t hart_count = 1;
+    char hart_entries[MAX_PATH] = "";
     uint8_t queue_size = 100;
 
     bool run_only_gui = false;
@@ -815,6 +1384,9 @@ int main(int argc, char *argv[]) {
     bool single_loop = false;
     bool help = false;
     ParseableArgument arguments[] = {
+        {"harts=", "ha=", &hart_count, strtou8, false}, // Before help, h is a prefix of both
+        {"hart-entries=", "he=", &hart_entries, strtostr, false},
+        {"history-bits=", "hb=", &history_bits, strtou8, false},
         {"help", "h", &help, strtobool, false},
         {"hilfe", "?", &help, strtobool, false},
         {"run-only-gui", "rog", &run_only_gui, strtobool, false},
@@ -823,6 +1395,38 @@ int main(int argc, char *argv[]) {
         {"overwrite-memory-size=", "ms=", &overwrite_memory_size, strtou32, false},
         {"overwrite-operand-size=", "os=", &overwrite_operand_size, strtou8, false},
         {"cache-bits=", "cb=", &cache_bits, strtou8, false},
+        {"cache-ways=", "cw=", &cache_ways, strtou8, false},
+        {"cache-policy=", "cp=", &cache_policy, strtopolicy, false},
+        {"line-words=", "lw=", &line_words, strtou8, false},
+        {"l2-cache-bits=", "l2b=", &l2_cache_bits, strtou8, false},
+        {"l2-cache-ways=", "l2w=", &l2_cache_ways, strtou8, false},
+        {"l2-cache-policy=", "l2p=", &l2_cache_policy, strtopolicy, false},
+        {"l2-exclusive", "l2x", &l2_exclusive, strtobool, false},
+        {"write-policy=", "wp=", &write_policy, strtowritepolicy, false},
+        {"no-write-allocate", "nwa", &no_write_allocate, strtobool, false},
+        {"write-buffer=", "wbuf=", &write_buffer_size, strtou8, false},
+        {"prefetcher=", "pf=", &prefetcher, strtoprefetcher, false},
+        {"shadow-caches=", "sc=", &shadow_caches, strtostr, false},
+        {"record-trace=", "rt=", &trace_path, strtostr, false},
+        {"reuse-json=", "rdj=", &reuse_json, strtostr, false}, // Before reuse-distance, rd is a prefix of rdj
+        {"reuse-distance", "rd", &reuse_distance, strtobool, false},
+        {"rewarm-cache", "rwc", &rewarm_cache_lines, strtobool, false},
+        {"no-cache-sim", "ncs", &no_cache_sim, strtobool, false},
+        {"cache-warmup=", "cwu=", &cache_warmup, strtowarmup, false},
+        {"warmup-profile=", "wup=", &warmup_profile, strtostr, false},
+        {"timing=", "tm=", &timing_path, strtostr, false},
+        {"pipeline", "pl", &pipeline_mode, strtobool, false},
+        {"branch-predictor=", "bp=", &predictor_kind, strtopredictor, false},
+        {"virtual-memory", "vm", &virtual_memory, strtobool, false},
+        {"page-bits=", "pgb=", &page_bits, strtou8, false},
+        {"page-table=", "pt=", &page_table, strtou32, false},
+        {"tlb-bits=", "tb=", &tlb_bits, strtou8, false},
+        {"tlb-ways=", "tw=", &tlb_ways, strtou8, false},
+        {"icache-bits=", "ib=", &icache_bits, strtou8, false},
+        {"icache-ways=", "iw=", &icache_ways, strtou8, false},
+        {"icache-line-words=", "ilw=", &icache_line_words, strtou8, false},
+        {"icache-policy=", "ip=", &icache_policy, strtopolicy, false},
+        {"unified-cache", "uc", &unified_cache, strtobool, false},
         {"queue-size=", "qs=", &queue_size, strtou8, false},
         {"immidiate-start", "is", &immidiate_start, strtobool, false},
         {"single-loop", "sl", &single_loop, strtobool, false},
@@ -845,6 +1449,45 @@ int main(int argc, char *argv[]) {
         printf("  overwrite-memory-size [ms]={%u-%u}    : Overwrites the memory size for all loaded files.\n", MIN_MEMORY_SIZE, MAX_MEMORY_SIZE);
         printf("  overwrite-operand-size [os]={%u-%u}  : Overwrites the operand size for all loaded files.\n", MIN_OPERAND_SIZE, MAX_OPERAND_SIZE);
         printf("  cache-bits [cb]={%u-%u}              : Sets the cache bits for the program, the default is 4.\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+        printf("  cache-ways [cw]={0-%u}              : Sets the associativity of the cache (power of two), the default is 1 (direct-mapped), 0 makes it fully associative.\n", MAX_CACHE_WAYS);
+        printf("  cache-policy [cp]={lru;plru;fifo;random} : Sets the replacement policy of the cache, the default is lru.\n");
+        printf("  line-words [lw]={%u-%u}              : Sets the cells per cache line (power of two), the default is 1.\n", MIN_LINE_WORDS, MAX_LINE_WORDS);
+        printf("  l2-cache-bits [l2b]={0;%u-%u}         : Adds an L2 cache behind the data cell cache, the default is 0 (no L2).\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+        printf("  l2-cache-ways [l2w]={0-%u}            : Sets the associativity of the L2 cache, the default is 1.\n", MAX_CACHE_WAYS);
+        printf("  l2-cache-policy [l2p]={lru;plru;fifo;random} : Sets the replacement policy of the L2 cache, the default is lru.\n");
+        printf("  l2-exclusive [l2x]                 : Keeps a line in only one level, the default is inclusive.\n");
+        printf("  write-policy [wp]={wb;wt}          : Sets the write policy of the cache, the default is wb (write-back).\n");
+        printf("  no-write-allocate [nwa]            : Store misses go past the cache instead of loading the line.\n");
+        printf("  write-buffer [wbuf]={0-%u}          : Adds a coalescing write buffer in front of RAM, the default is 0 (none).\n", MAX_WRITE_BUFFER_SIZE);
+        printf("  prefetcher [pf]={none;next-line;stride;stream} : Sets the data cache prefetcher, the default is none.\n");
+        printf("  shadow-caches [sc]={bits[-bits][:ways[:policy[:line_words]]],...} : Counts hits and misses of extra cache models over the same run, e.g. 1-6:1:lru.\n");
+        printf("  record-trace [rt]={path}           : Records every data access to a trace file for pasm-cachesim.\n");
+        printf("  reuse-distance [rd]                : Prints the LRU stack distance histogram of the data accesses at STP.\n");
+        printf("  reuse-json [rdj]={path}            : Also writes the reuse distance histogram as JSON at STP.\n");
+        printf("  rewarm-cache [rwc]                 : A cache change keeps the lines of the old cache instead of starting cold.\n");
+        printf("  no-cache-sim [ncs]                 : Data cells go straight to RAM, no cache statistics, the final RAM is the same.\n");
+        printf("  cache-warmup [cwu]={cold;load;profile} : What the cache holds at the start, the default is load (the data cells of the file).\n");
+        printf("  warmup-profile [wup]={path}        : Trace written with record-trace= whose hottest addresses cache-warmup=profile preloads.\n");
+        printf("  timing [tm]={path}                 : Latencies of the cycle estimate printed at STP, lines of class = cycles with the classes\n");
+        printf("                                       other, immediate, load, store, alu, mul, div, jump, hit, l2-hit, miss and write-back.\n");
+        printf("  pipeline [pl]                      : Replays the run on a 5-stage pipeline and prints its cycles and load-use, control, memory\n");
+        printf("                                       and execute stalls at STP, the latencies come from the timing model.\n");
+        printf("  branch-predictor [bp]={not-taken;taken;bimodal;gshare} : Predicts the conditional jumps, a BTB the indirect targets,\n");
+        printf("                                       and prints the accuracy of every jump at STP, the pipeline pays for its mispredictions.\n");
+        printf("  history-bits [hb]={1-%u}            : Global history the gshare predictor xors into the jump address, the default is 8.\n", MAX_HISTORY_BITS);
+        printf("  virtual-memory [vm]                : Data addresses go through a TLB and a two-level page table in RAM, pages get a frame on\n");
+        printf("                                       their first access, the file maps to itself. Needs free RAM, see overwrite-memory-size.\n");
+        printf("  page-bits [pgb]={%u-%u}             : Cells per page (power of two), the default is 4 (16 cells, 12 bit addresses).\n", MIN_PAGE_BITS, MAX_PAGE_BITS);
+        printf("  page-table [pt]={cell}             : Page aligned cell of the root page table, the default is the last page of RAM.\n");
+        printf("  tlb-bits [tb]={%u-%u}               : Sets the TLB entries, the default is 3 (8 entries).\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+        printf("  tlb-ways [tw]={0-%u}                : Sets the associativity of the TLB, the default is 0 (fully associative).\n", MAX_CACHE_WAYS);
+        printf("  icache-bits [ib]={0;%u-%u}          : Adds a split instruction cache fed by the fetch stream, the default is 0 (fetch is free).\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+        printf("  icache-ways [iw]={0-%u}             : Sets the associativity of the instruction cache, the default is 1.\n", MAX_CACHE_WAYS);
+        printf("  icache-line-words [ilw]={%u-%u}      : Sets the cells per instruction cache line, the default is 4.\n", MIN_LINE_WORDS, MAX_LINE_WORDS);
+        printf("  icache-policy [ip]={lru;plru;fifo;random} : Sets the replacement policy of the instruction cache, the default is lru.\n");
+        printf("  unified-cache [uc]                 : Instructions are fetched through the data cell cache instead.\n");
+        printf("  harts [ha]={1-%u}                  : Runs the file on several harts with private caches kept coherent by MESI, needs disable-gui. Storing to an instruction cell stops the hart.\n", MAX_HARTS);
+        printf("  hart-entries [he]={address,...}    : Where each hart starts, the default is 0 for all of them.\n");
         printf("  queue-size [qs]={>0}               : Sets the queue size for the program, the default is 100.\n");
         printf("  immidiate-start [is]               : Immidiately starts the program, can only be used if you also specify a file.\n");
         printf("  single-loop [sl]                   : Makes the program exit after one loop (1 file execution).\n");
@@ -858,10 +1501,51 @@ int main(int argc, char *argv[]) {
         ShowWindow( hWnd, SW_HIDE );
     }*/
 
-    if (run_only_gui) {
+    if (cache_warmup == WARMUP_PROFILE && warmup_profile[0] == '\0') {
+        fprintf(stderr, "cache-warmup=profile needs a trace from an earlier run, pass it with warmup-profile=.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (hart_count == 0 || hart_count > MAX_HARTS) {
+        fprintf(stderr, "The hart count %u is not in range (1:%u).\n", hart_count, MAX_HARTS);
+        exit(EXIT_FAILURE);
+    } else if (hart_count > 1 && (!disable_gui || input_file[0] == '\0')) {
+        fprintf(stderr, "Several harts only run without the GUI and need a file.\n");
+        exit(EXIT_FAILURE);
+    } else if (hart_count > 1 && (l2_cache_bits > 0 || write_policy != WRITE_BACK || no_write_allocate || write_buffer_size > 0
+                                  || prefetcher != PREFETCH_NONE || trace_path[0] != '\0' || no_cache_sim)) {
+        fprintf(stderr, "Several harts only support a single write-back, write-allocate level without write buffer, prefetcher, trace or no-cache-sim.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (hart_count > 1 && (pipeline_mode || predictor_kind <= MAX_PREDICTOR || virtual_memory)) {
+        fprintf(stderr, "The pipeline mode, the branch predictors and virtual memory only model a single hart.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (icache_bits > 0 && unified_cache) {
+        fprintf(stderr, "The instruction cache is either split (icache-bits=) or unified with the data cell cache, not both.\n");
+        exit(EXIT_FAILURE);
+    } else if ((icache_bits > 0 || unified_cache) && hart_count > 1) {
+        fprintf(stderr, "The instruction cache only models a single hart.\n");
+        exit(EXIT_FAILURE);
+    } else if (unified_cache && no_cache_sim) {
+        fprintf(stderr, "A unified cache needs the cache simulation, no-cache-sim turns it off.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (page_bits < MIN_PAGE_BITS || page_bits > MAX_PAGE_BITS) {
+        fprintf(stderr, "The page bits %u are not in range (%u:%u).\n", page_bits, MIN_PAGE_BITS, MAX_PAGE_BITS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (hart_count > 1) {
+        exit_code = run_harts(argv[0], input_file, hart_count, hart_entries, cache_bits, cache_ways, line_words, cache_policy, shadow_caches,
+                              reuse_distance, timing_path);
+    } else if (run_only_gui) {
         exit_code = run_gui();
     } else {
-        exit_code = p_program(argv[0], disable_gui, single_step_mode, overwrite_memory_size, overwrite_operand_size, input_file, cache_bits, queue_size, immidiate_start, single_loop);
+        exit_code = p_program(argv[0], disable_gui, single_step_mode, overwrite_memory_size, overwrite_operand_size, input_file, cache_bits, cache_ways, line_words, cache_policy, l2_cache_bits, l2_cache_ways, l2_cache_policy, l2_exclusive, write_policy, !no_write_allocate, write_buffer_size, prefetcher, shadow_caches, trace_path, reuse_distance, reuse_json, rewarm_cache_lines, !no_cache_sim, cache_warmup, warmup_profile, timing_path, pipeline_mode, predictor_kind, history_bits, virtual_memory, page_bits, page_table, tlb_bits, tlb_ways, icache_bits, icache_ways, icache_line_words, icache_policy, unified_cache, queue_size, immidiate_start, single_loop);
     }
     return exit_code;
 }
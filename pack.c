@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <limits.h>
+  #define MAX_PATH PATH_MAX
+#endif
+
+#include "putils.h"
+#include "pconstants.h"
+
+// Converts a .p file between the plain layout and the packed container, read_file loads either one
+
+static uint64_t write_plain_file(const char *path, const uint8_t *ram, uint64_t cell_count, uint8_t operand_size, uint32_t memory_size) {
+    uint8_t instruction_size = 1 + operand_size;
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite("EMUL", 1, 4, file);
+    fwrite(&operand_size, sizeof(uint8_t), 1, file);
+    fwrite(&memory_size, sizeof(uint32_t), 1, file);
+    fwrite(ram, instruction_size, cell_count, file); // RAM holds the cells exactly like the file
+    bool is_written = !ferror(file);
+    long size = ftell(file);
+    if (fclose(file) != 0 || !is_written || size < 0) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)size;
+}
+
+int main(int argc, char *argv[]) {
+    char input_path[MAX_PATH] = "";
+    char output_path[MAX_PATH] = "";
+    bool unpack = false;
+    bool help = false;
+    ParseableArgument arguments[] = {
+        {"help", "h", &help, strtobool, false},
+        {"unpack", "u", &unpack, strtobool, false},
+        {"output=", "o=", &output_path, strtostr, false},
+        {"", "", &input_path, strtostr, false}, // Positional argument
+    };
+    int num_arguments = sizeof(arguments) / sizeof(ParseableArgument);
+    if (parse_arguments(argc, argv, arguments, num_arguments) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    if (help || input_path[0] == '\0' || output_path[0] == '\0') {
+        printf("pasm-pack Help Menu ~Flags~:\n");
+        printf("  help [h]                           : Opens this menu.\n");
+        printf("  unpack [u]                         : Writes a plain .p file instead of a packed one.\n");
+        printf("  output [o]={path}.p                : Where the converted program is written.\n");
+        printf("  {positional_arg}.p                 : The program to convert, plain or packed.\n");
+        return help ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!ends_with(input_path, ".p") || !ends_with(output_path, ".p")) {
+        fprintf(stderr, "Usage: %s [arguments] <file>.p, the output has to end in '.p' as well.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The smallest cache stays cold, read_file only has to validate and load the program
+    Cache *cache = create_cache(MIN_CACHE_BITS, 1, 1, POLICY_LRU);
+    set_cache_warmup(cache, WARMUP_COLD, NULL);
+    uint64_t file_size;
+    uint32_t memory_size;
+    uint8_t operand_size;
+    char absolute_path[MAX_PATH];
+    if (realpath(input_path, absolute_path) == NULL) {
+        perror("realpath");
+        return EXIT_FAILURE;
+    }
+    uint8_t *ram = read_file(absolute_path, cache, &file_size, &memory_size, &operand_size);
+    free_cache(cache);
+    uint64_t cell_count = file_size / (1 + operand_size);
+
+    uint64_t size = unpack ? write_plain_file(output_path, ram, cell_count, operand_size, memory_size)
+                           : write_packed_image(output_path, ram, cell_count, operand_size, memory_size);
+    printf("Wrote %" PRIu64 " cells to %s: %" PRIu64 " bytes of cells in %" PRIu64 " bytes (%.2fx)\n",
+           cell_count, output_path, file_size, size, size ? (double)file_size / size : 0.0);
+    free_ram(ram);
+    return EXIT_SUCCESS;
+}
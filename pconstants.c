@@ -7,3 +7,41 @@ const char *INSTRUCTION_SET[] = {
     [80]="JNZ_DIR", [81]="JNZ_IND", [90]="JZE_DIR", [91]="JZE_IND", 
     [92]="JLE_DIR", [93]="JLE_IND", [99]="STP"
 };
+
+const char *REPLACEMENT_POLICIES[] = {
+    [POLICY_LRU]="lru", [POLICY_PLRU]="plru", [POLICY_FIFO]="fifo", [POLICY_RANDOM]="random"
+};
+
+const char *WRITE_POLICIES[] = {
+    [WRITE_BACK]="wb", [WRITE_THROUGH]="wt"
+};
+
+const char *PREFETCHERS[] = {
+    [PREFETCH_NONE]="none", [PREFETCH_NEXT_LINE]="next-line", [PREFETCH_STRIDE]="stride", [PREFETCH_STREAM]="stream"
+};
+
+const char *WARMUP_MODES[] = {
+    [WARMUP_COLD]="cold", [WARMUP_LOAD]="load", [WARMUP_PROFILE]="profile"
+};
+
+// Also the keys of a timing file
+const char *TIMING_CLASSES[] = {
+    [TIMING_OTHER]="other", [TIMING_IMMEDIATE]="immediate", [TIMING_LOAD]="load", [TIMING_STORE]="store", 
+    [TIMING_ALU]="alu", [TIMING_MUL]="mul", [TIMING_DIV]="div", [TIMING_JUMP]="jump"
+};
+
+const uint8_t OPCODE_TIMING_CLASSES[OPCODE_COUNT] = {
+    [10]=TIMING_IMMEDIATE, [11]=TIMING_LOAD, [12]=TIMING_LOAD, 
+    [20]=TIMING_STORE, [21]=TIMING_STORE, [30]=TIMING_ALU, [40]=TIMING_ALU, 
+    [50]=TIMING_MUL, [60]=TIMING_DIV, [70]=TIMING_JUMP, [71]=TIMING_JUMP, 
+    [80]=TIMING_JUMP, [81]=TIMING_JUMP, [90]=TIMING_JUMP, [91]=TIMING_JUMP, 
+    [92]=TIMING_JUMP, [93]=TIMING_JUMP
+};
+
+const char *PREDICTORS[] = {
+    [PREDICT_NOT_TAKEN]="not-taken", [PREDICT_TAKEN]="taken", [PREDICT_BIMODAL]="bimodal", [PREDICT_GSHARE]="gshare"
+};
+
+const char *PIPELINE_STAGE_NAMES[PIPELINE_STAGES] = {
+    "IF", "ID", "EX", "MEM", "WB"
+};
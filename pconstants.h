@@ -23,10 +23,32 @@
 #define MIN_CACHE_BITS 1
 #define MAX_CACHE_BITS 6 // Number of bits to use for the index (e.g., 4 bits for 16 entries)
 #define MAX_CACHE_SIZE (1 << MAX_CACHE_BITS) // Total cache size based on MAX_CACHE_BITS
+#define MIN_CACHE_WAYS 1 // Direct-mapped
+#define MAX_CACHE_WAYS MAX_CACHE_SIZE // Fully associative, the same as passing 0 ways
+#define MIN_LINE_WORDS 1
+#define MAX_LINE_WORDS 8 // Cells per cache line
+#define MAX_WRITE_BUFFER_SIZE 16 // Entries of the coalescing write buffer in front of RAM
+#define STRIDE_TABLE_SIZE 16 // Entries of the stride prefetcher, indexed by instruction address
+#define STREAM_BUFFER_SIZE 4 // Lines the stream buffer runs ahead
+#define PREFETCH_LATENCY 4 // Data accesses a prefetch needs to arrive, used sooner it counts as late
+#define MAX_SHADOW_CACHES 32 // Extra cache models fed the same accesses in one run
+#define REUSE_HISTOGRAM_SIZE 256 // Exact reuse distances kept, four times MAX_CACHE_SIZE, longer ones share a bucket
+#define MIN_REUSE_CAPACITY 1024 // Initial access times of the reuse distance tree
+#define TRACE_MAGIC "PTRC" // Header of a recorded data address trace
+#define TRACE_VERSION 1
+#define PACKED_MAGIC "EMUZ" // Header of a compressed .p image, plain ones start with "EMUL"
+#define PACKED_VERSION 1
+#define PACKED_BLOCK_CELLS 65536 // Cells per compressed block, a multiple of 64 like the slices of the loader
+#define PACKED_HASH_BITS 14 // Entries of the match finder of the block compressor
+#define PACKED_MIN_MATCH 4 // Shortest repeated sequence worth a back reference
+#define MAX_HARTS 64 // Guest harts sharing one RAM, each runs on its own host thread
 #define MAX_PROGRAM_SIZE ((uint64_t)21474836484) // 2GB or 2,048mb * instruction_size
 
-#define MIN_READ_BUFFER_SIZE 512       // Minimum read buffer size (512 bytes)
-#define MAX_READ_BUFFER_SIZE (4 * 1024 * 1024) // Maximum read buffer size (4 MB)
+#define STREAM_WINDOW_SIZE (4 * 1024 * 1024) // Bytes of RAM the streaming loader reads at once
+#define STREAM_WINDOWS 2 // One is read while the other one is decoded
+#define MAX_MAPPED_IMAGES 8 // Files mapped as RAM at the same time, loaded images and their snapshots
+#define MAX_LOADER_THREADS 16 // Threads decoding the slices of a large image
+#define MIN_LOADER_SLICE_CELLS 262144 // Smaller images are decoded by the loading thread alone
 
 #define NOP 0x00
 #define LDA_IMM 0x0A
@@ -47,10 +69,75 @@
 #define JLE_DIR 0x5C
 #define JLE_IND 0x5D
 #define STP 0x63
+#define OPCODE_COUNT (STP + 1)
 
 // Instruction set mapping
 extern const char *INSTRUCTION_SET[];
 
+// Cache replacement policies
+#define POLICY_LRU 0
+#define POLICY_PLRU 1 // Tree pseudo-LRU
+#define POLICY_FIFO 2
+#define POLICY_RANDOM 3
+#define MAX_POLICY POLICY_RANDOM
+extern const char *REPLACEMENT_POLICIES[];
+
+// Cache write policies
+#define WRITE_BACK 0
+#define WRITE_THROUGH 1
+#define MAX_WRITE_POLICY WRITE_THROUGH
+extern const char *WRITE_POLICIES[];
+
+// Data cache prefetchers
+#define PREFETCH_NONE 0
+#define PREFETCH_NEXT_LINE 1
+#define PREFETCH_STRIDE 2 // Reference prediction table keyed on the instruction address
+#define PREFETCH_STREAM 3 // Stream buffer for the LDA_IND pointer walks
+#define MAX_PREFETCHER PREFETCH_STREAM
+extern const char *PREFETCHERS[];
+
+// What the cache holds when the program starts
+#define WARMUP_COLD 0 // Empty
+#define WARMUP_LOAD 1 // Every data cell of the file in order, the last one mapping to a set wins
+#define WARMUP_PROFILE 2 // The hottest addresses of a recorded trace
+#define MAX_WARMUP WARMUP_PROFILE
+extern const char *WARMUP_MODES[];
+
+// Instruction classes of the timing model, each one has its own latency
+#define TIMING_OTHER 0 // NOP, STP
+#define TIMING_IMMEDIATE 1 // LDA_IMM
+#define TIMING_LOAD 2 // LDA_DIR, LDA_IND
+#define TIMING_STORE 3 // STA_DIR, STA_IND
+#define TIMING_ALU 4 // ADD_DIR, SUB_DIR
+#define TIMING_MUL 5
+#define TIMING_DIV 6
+#define TIMING_JUMP 7 // Every jump, taken or not
+#define TIMING_CLASS_COUNT 8
+extern const char *TIMING_CLASSES[];
+extern const uint8_t OPCODE_TIMING_CLASSES[];
+
+// Branch predictors of the conditional jumps, indirect targets come from the BTB
+#define PREDICT_NOT_TAKEN 0
+#define PREDICT_TAKEN 1
+#define PREDICT_BIMODAL 2 // 2-bit counters indexed by the jump address
+#define PREDICT_GSHARE 3 // 2-bit counters indexed by the jump address xor the global history
+#define MAX_PREDICTOR PREDICT_GSHARE
+extern const char *PREDICTORS[];
+#define PREDICTOR_TABLE_BITS 12 // 2-bit counters of bimodal and gshare
+#define MAX_HISTORY_BITS PREDICTOR_TABLE_BITS
+#define BTB_SIZE 64 // Direct-mapped branch target buffer entries
+#define BRANCH_REPORT_SITES 20 // Jumps listed at STP, the most mispredicted first
+
+// Virtual memory, both levels of the page table are one page of PTE cells
+#define MIN_PAGE_BITS 2
+#define MAX_PAGE_BITS 10 // Three times the page bits are the virtual address bits
+#define NO_PAGE_TABLE UINT32_MAX // Put the root table into the last frame of RAM
+
+// Pipeline mode
+#define PIPELINE_STAGES 5 // IF, ID, EX, MEM, WB
+#define PIPELINE_BUBBLE UINT32_MAX // Stage holds no instruction
+extern const char *PIPELINE_STAGE_NAMES[];
+
 // Bridge codes
 #define IC_NOTHING 0
 // Backend interrupt codes (Gui->Backend)
@@ -6,6 +6,13 @@
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#endif
 
 #include "putils.h"
 #include "pconstants.h"
@@ -15,10 +22,23 @@
 // Cache
 // *************************************************
 
-Cache *create_cache(uint8_t cache_bits) {
+static inline uint16_t get_word_count(const Cache *cache) {
+    return (uint16_t)cache->size << cache->line_bits;
+}
+
+Cache *create_cache(uint8_t cache_bits, uint8_t ways, uint8_t line_words, uint8_t policy) {
     if (cache_bits < MIN_CACHE_BITS || cache_bits > MAX_CACHE_BITS) {
         fprintf(stderr, "Passed cache bits is not in range (%u:%u) %u.\n", MIN_CACHE_BITS, MAX_CACHE_BITS, cache_bits);
         exit(EXIT_FAILURE);
+    } else if (ways > (1 << cache_bits) || (ways & (ways - 1)) != 0) {
+        fprintf(stderr, "Passed cache ways has to be a power of two in range (%u:%u) %u.\n", MIN_CACHE_WAYS, 1 << cache_bits, ways);
+        exit(EXIT_FAILURE);
+    } else if (line_words < MIN_LINE_WORDS || line_words > MAX_LINE_WORDS || (line_words & (line_words - 1)) != 0) {
+        fprintf(stderr, "Passed line words has to be a power of two in range (%u:%u) %u.\n", MIN_LINE_WORDS, MAX_LINE_WORDS, line_words);
+        exit(EXIT_FAILURE);
+    } else if (policy > MAX_POLICY) {
+        fprintf(stderr, "Passed replacement policy is unknown %u.\n", policy);
+        exit(EXIT_FAILURE);
     }
     Cache *cache = malloc(sizeof(Cache));
     if (!cache) {
@@ -27,75 +47,1241 @@ Cache *create_cache(uint8_t cache_bits) {
     }
     cache->size = 1 << cache_bits;
     cache->cache_bits = cache_bits;
-    cache->entries = malloc(cache->size * sizeof(uint64_t));
-    if (!cache->entries) {
+    cache->fully_associative = ways == 0 || ways == cache->size;
+    if (cache->fully_associative) {
+        ways = cache->size; // One set holding every entry
+    }
+    cache->ways = ways;
+    cache->way_bits = 0;
+    while ((1 << cache->way_bits) < ways) cache->way_bits++;
+    cache->set_bits = cache_bits - cache->way_bits;
+    cache->line_words = line_words;
+    cache->line_bits = 0;
+    while ((1 << cache->line_bits) < line_words) cache->line_bits++;
+    cache->policy = policy;
+    cache->last_word = 0;
+    cache->ram = NULL;
+    cache->ram_size = 0;
+    cache->instruction_size = 0;
+    cache->next_level = NULL;
+    cache->upper_level = NULL;
+    cache->exclusive = false;
+    cache->write_policy = WRITE_BACK;
+    cache->write_allocate = true;
+    cache->write_buffer = NULL;
+    cache->write_buffer_size = 0;
+    cache->prefetcher = NULL;
+    cache->shadow_caches = NULL;
+    cache->shadow_cache_count = 0;
+    cache->trace = NULL;
+    cache->reuse = NULL;
+    cache->bus = NULL;
+    cache->hart = 0;
+    cache->shared_mask = 0;
+    cache->invalidated_lines = NULL;
+    cache->warmup = WARMUP_LOAD;
+    cache->warmup_profile = NULL;
+    cache->seen_lines = NULL;
+    cache->seen_lines_count = 0;
+    cache->access_pc = 0;
+    cache->access_opcode = 0;
+    cache->access_index = 0;
+    cache->operands = malloc(get_word_count(cache) * sizeof(uint32_t));
+    cache->dirty_masks = malloc(cache->size * sizeof(uint8_t));
+    cache->ages = malloc(cache->size * sizeof(uint8_t));
+    cache->set_states = malloc((1 << cache->set_bits) * sizeof(uint64_t));
+    cache->tags = malloc(cache->size * sizeof(uint32_t));
+    if (!cache->operands || !cache->dirty_masks || !cache->ages || !cache->set_states || !cache->tags) {
         perror("Failed to allocate memory for Cache entries");
+        free(cache->operands);
+        free(cache->dirty_masks);
+        free(cache->ages);
+        free(cache->set_states);
+        free(cache->tags);
         free(cache);
         exit(EXIT_FAILURE);
     }
-    memset(cache->entries, 0, cache->size * sizeof(uint64_t)); // Initialize cache to zero
+    reset_cache(cache);
     return cache;
 }
 
 void reset_cache(Cache *cache) {
-    memset(cache->entries, 0, cache->size * sizeof(uint64_t)); // Reset cache to zero
+    memset(cache->operands, 0, get_word_count(cache) * sizeof(uint32_t)); // Reset cache to zero
+    memset(cache->dirty_masks, 0, cache->size * sizeof(uint8_t));
+    memset(cache->tags, 0, cache->size * sizeof(uint32_t));
+    memset(cache->set_states, 0, (1 << cache->set_bits) * sizeof(uint64_t));
+    cache->valid_mask = 0;
+    cache->shared_mask = 0;
+    cache->evicted_count = 0;
+    for (uint8_t i = 0; i < cache->size; i++) {
+        cache->ages[i] = i & (cache->ways - 1); // Every set starts with a valid LRU order
+    }
+    cache->random_state = 0x9E3779B9; // Fixed seed so runs stay reproducible
+    cache->write_buffer_count = 0;
+    cache->shadow_count = 0;
+    if (cache->seen_lines) {
+        memset(cache->seen_lines, 0, ((cache->seen_lines_count + 63) >> 6) * sizeof(uint64_t));
+    }
+    if (cache->invalidated_lines) {
+        memset(cache->invalidated_lines, 0, ((cache->seen_lines_count + 63) >> 6) * sizeof(uint64_t));
+    }
+    if (cache->prefetcher) {
+        set_prefetcher(cache, cache->prefetcher->kind); // Forget everything it learned
+    }
+    for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+        reset_cache(cache->shadow_caches[i]);
+    }
+    if (cache->reuse) {
+        ReuseAnalyzer *reuse = cache->reuse;
+        memset(reuse->tree, 0, (reuse->capacity + 1) * sizeof(uint64_t));
+        memset(reuse->last_times, 0, reuse->line_count * sizeof(uint64_t));
+        reuse->time = 1;
+        reuse->distinct_lines = 0;
+    }
+    reset_cache_stats(cache);
+    if (cache->next_level) {
+        reset_cache(cache->next_level);
+    }
+}
+
+void reset_cache_stats(Cache *cache) {
+    for (; cache; cache = cache->next_level) {
+        memset(&cache->counters, 0, sizeof(CacheCounters));
+        memset(cache->opcode_counters, 0, sizeof(cache->opcode_counters));
+        memset(&cache->fetch_counters, 0, sizeof(CacheCounters));
+        memset(&cache->coherence, 0, sizeof(CoherenceCounters));
+        cache->ram_writes = 0;
+        cache->coalesced_writes = 0;
+        if (cache->prefetcher) {
+            cache->prefetcher->issued = 0;
+            cache->prefetcher->useful = 0;
+            cache->prefetcher->late = 0;
+            cache->prefetcher->polluting = 0;
+        }
+        for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+            reset_cache_stats(cache->shadow_caches[i]);
+        }
+        if (cache->reuse) {
+            memset(cache->reuse->histogram, 0, sizeof(cache->reuse->histogram));
+            cache->reuse->cold_accesses = 0;
+            cache->reuse->accesses = 0;
+        }
+    }
+}
+
+void set_prefetcher(Cache *cache, uint8_t kind) {
+    if (kind > MAX_PREFETCHER) {
+        fprintf(stderr, "Passed prefetcher is unknown %u.\n", kind);
+        exit(EXIT_FAILURE);
+    }
+    free(cache->prefetcher);
+    cache->prefetcher = NULL;
+    if (kind == PREFETCH_NONE) {
+        return;
+    }
+    cache->prefetcher = calloc(1, sizeof(Prefetcher));
+    if (!cache->prefetcher) {
+        perror("Failed to allocate memory for the prefetcher");
+        exit(EXIT_FAILURE);
+    }
+    cache->prefetcher->kind = kind;
+}
+
+void set_access_context(Cache *cache, uint32_t pc, uint8_t op_code) {
+    cache->access_pc = pc;
+    cache->access_opcode = op_code < OPCODE_COUNT ? op_code : 0;
+    cache->access_index = 0;
+}
+
+// Parses a comma separated list of bits[-bits][:ways[:policy[:line_words]]], a bits range adds one cache per size
+uint8_t create_caches_from_spec(const char *spec, uint8_t line_words, Cache **caches, uint8_t max_caches) {
+    const char *cursor = spec;
+    uint8_t count = 0;
+    while (*cursor) {
+        char *end;
+        char policy_name[16] = "lru";
+        unsigned long first_bits = strtoul(cursor, &end, 10);
+        unsigned long last_bits = first_bits;
+        unsigned long ways = 1;
+        unsigned long spec_line_words = line_words;
+        uint8_t policy = POLICY_LRU;
+        if (end == cursor) {
+            fprintf(stderr, "Passed shadow cache has to start with its cache bits '%s'.\n", cursor);
+            exit(EXIT_FAILURE);
+        }
+        if (*end == '-') {
+            last_bits = strtoul(end + 1, &end, 10);
+        }
+        if (*end == ':') {
+            ways = strtoul(end + 1, &end, 10);
+        }
+        if (*end == ':') {
+            size_t length = strcspn(end + 1, ":,");
+            if (length == 0 || length >= sizeof(policy_name)) {
+                fprintf(stderr, "Passed shadow cache policy is invalid '%s'.\n", end + 1);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(policy_name, end + 1, length);
+            policy_name[length] = '\0';
+            end += length + 1;
+        }
+        if (*end == ':') {
+            spec_line_words = strtoul(end + 1, &end, 10);
+        }
+        if (*end != ',' && *end != '\0') {
+            fprintf(stderr, "Passed shadow cache is malformed '%s'.\n", cursor);
+            exit(EXIT_FAILURE);
+        }
+        // Checked before they are shifted by or narrowed to the uint8_t create_cache takes
+        if (first_bits < MIN_CACHE_BITS || last_bits > MAX_CACHE_BITS || first_bits > last_bits) {
+            fprintf(stderr, "Passed shadow cache bits are not in range (%u:%u) '%s'.\n", MIN_CACHE_BITS, MAX_CACHE_BITS, cursor);
+            exit(EXIT_FAILURE);
+        } else if (ways > MAX_CACHE_WAYS) {
+            fprintf(stderr, "Passed shadow cache ways are not in range (0:%u) %lu.\n", MAX_CACHE_WAYS, ways);
+            exit(EXIT_FAILURE);
+        } else if (spec_line_words < MIN_LINE_WORDS || spec_line_words > MAX_LINE_WORDS) {
+            fprintf(stderr, "Passed shadow cache line words are not in range (%u:%u) %lu.\n", MIN_LINE_WORDS, MAX_LINE_WORDS, spec_line_words);
+            exit(EXIT_FAILURE);
+        }
+        strtopolicy(policy_name, &policy);
+        for (unsigned long bits = first_bits; bits <= last_bits; bits++) {
+            if (count == max_caches) {
+                fprintf(stderr, "Passed more than %u cache configurations.\n", max_caches);
+                exit(EXIT_FAILURE);
+            }
+            // Ways wider than a small size of the range make it fully associative
+            uint8_t spec_ways = ways > (1UL << bits) ? 0 : (uint8_t)ways;
+            caches[count++] = create_cache((uint8_t)bits, spec_ways, (uint8_t)spec_line_words, policy);
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+void add_shadow_caches(Cache *cache, const char *spec) {
+    Cache *shadows[MAX_SHADOW_CACHES];
+    uint8_t count = create_caches_from_spec(spec, cache->line_words, shadows, MAX_SHADOW_CACHES - cache->shadow_cache_count);
+    if (count == 0) {
+        return;
+    }
+    Cache **shadow_caches = realloc(cache->shadow_caches, (cache->shadow_cache_count + count) * sizeof(Cache *));
+    if (!shadow_caches) {
+        perror("Failed to allocate memory for the shadow caches");
+        exit(EXIT_FAILURE);
+    }
+    cache->shadow_caches = shadow_caches;
+    for (uint8_t i = 0; i < count; i++) {
+        attach_cache_ram(shadows[i], cache->ram, cache->ram_size, cache->instruction_size);
+        cache->shadow_caches[cache->shadow_cache_count++] = shadows[i];
+    }
+}
+
+void set_write_policy(Cache *cache, uint8_t write_policy, bool write_allocate, uint8_t write_buffer_size) {
+    if (write_policy > MAX_WRITE_POLICY) {
+        fprintf(stderr, "Passed write policy is unknown %u.\n", write_policy);
+        exit(EXIT_FAILURE);
+    } else if (write_buffer_size > MAX_WRITE_BUFFER_SIZE) {
+        fprintf(stderr, "Passed write buffer size is not in range (0:%u) %u.\n", MAX_WRITE_BUFFER_SIZE, write_buffer_size);
+        exit(EXIT_FAILURE);
+    }
+    cache->write_policy = write_policy;
+    cache->write_allocate = write_allocate;
+    free(cache->write_buffer);
+    cache->write_buffer = NULL;
+    if (write_buffer_size > 0) {
+        cache->write_buffer = malloc(write_buffer_size * sizeof(uint64_t));
+        if (!cache->write_buffer) {
+            perror("Failed to allocate memory for the write buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    cache->write_buffer_size = write_buffer_size;
+    cache->write_buffer_count = 0;
 }
 
 void free_cache(Cache *cache) {
     if (cache) {
-        free(cache->entries);
-        cache->entries = NULL; // Prevent double-free
+        free_cache(cache->next_level);
+        for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+            free_cache(cache->shadow_caches[i]);
+        }
+        free(cache->shadow_caches);
+        if (cache->reuse) {
+            free(cache->reuse->tree);
+            free(cache->reuse->time_lines);
+            free(cache->reuse->last_times);
+            free(cache->reuse);
+        }
+        free(cache->write_buffer);
+        free(cache->prefetcher);
+        free(cache->seen_lines);
+        free(cache->invalidated_lines);
+        free(cache->operands);
+        free(cache->dirty_masks);
+        free(cache->ages);
+        free(cache->set_states);
+        free(cache->tags);
+        cache->operands = NULL; // Prevent double-free
         free(cache);
         cache = NULL; // Prevent further access
     }
 }
 
+void attach_cache_ram(Cache *cache, uint8_t *ram, uint64_t ram_size, uint8_t instruction_size) {
+    cache->ram = ram;
+    cache->ram_size = ram_size;
+    cache->instruction_size = instruction_size;
+    // One bit per line of RAM for the compulsory miss classification
+    uint64_t seen_lines_count = instruction_size ? ram_size / instruction_size / cache->line_words + 1 : 0;
+    uint64_t *seen_lines = realloc(cache->seen_lines, ((seen_lines_count + 63) >> 6) * sizeof(uint64_t));
+    if (seen_lines_count && !seen_lines) {
+        perror("Failed to allocate memory for the seen lines");
+        exit(EXIT_FAILURE);
+    }
+    if (seen_lines_count > cache->seen_lines_count) {
+        uint64_t old_words = (cache->seen_lines_count + 63) >> 6;
+        memset(seen_lines + old_words, 0, (((seen_lines_count + 63) >> 6) - old_words) * sizeof(uint64_t));
+    }
+    cache->seen_lines = seen_lines;
+    cache->seen_lines_count = seen_lines_count;
+    if (cache->next_level) {
+        attach_cache_ram(cache->next_level, ram, ram_size, instruction_size);
+    }
+    for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+        attach_cache_ram(cache->shadow_caches[i], ram, ram_size, instruction_size);
+    }
+    if (cache->reuse && seen_lines_count > cache->reuse->line_count) {
+        uint64_t *last_times = realloc(cache->reuse->last_times, seen_lines_count * sizeof(uint64_t));
+        if (!last_times) {
+            perror("Failed to allocate memory for the reuse distance lines");
+            exit(EXIT_FAILURE);
+        }
+        memset(last_times + cache->reuse->line_count, 0, (seen_lines_count - cache->reuse->line_count) * sizeof(uint64_t));
+        cache->reuse->last_times = last_times;
+        cache->reuse->line_count = seen_lines_count;
+    }
+}
+
+void attach_next_level(Cache *cache, Cache *next_level, bool exclusive) {
+    if (next_level->line_words != cache->line_words) {
+        fprintf(stderr, "Both cache levels have to use the same line words (%u != %u).\n", cache->line_words, next_level->line_words);
+        exit(EXIT_FAILURE);
+    }
+    cache->next_level = next_level;
+    cache->exclusive = exclusive;
+    next_level->upper_level = cache;
+    attach_cache_ram(next_level, cache->ram, cache->ram_size, cache->instruction_size);
+}
+
 uint8_t get_cache_index(uint8_t cache_bits, uint32_t address) {
     return (address & ((1 << cache_bits) - 1)); // Mask the lower cache_bits bits
 }
 
+static inline uint8_t get_set(const Cache *cache, uint32_t address) {
+    return get_cache_index(cache->set_bits, address >> cache->line_bits);
+}
+
+static inline uint64_t get_way_mask(const Cache *cache) {
+    return cache->ways == 64 ? UINT64_MAX : (1ULL << cache->ways) - 1;
+}
+
+static inline bool is_slot_valid(const Cache *cache, uint8_t slot) {
+    return (cache->valid_mask >> slot) & 1;
+}
+
+// The tag of the slot holds the whole line address, so no bits have to be put back together
+static inline uint32_t get_word_address(const Cache *cache, uint16_t index) {
+    return (cache->tags[index >> cache->line_bits] << cache->line_bits) | (index & (cache->line_words - 1));
+}
+
+static inline bool is_word_dirty(const Cache *cache, uint16_t index) {
+    return (cache->dirty_masks[index >> cache->line_bits] >> (index & (cache->line_words - 1))) & 1;
+}
+
+static inline void set_word(Cache *cache, uint16_t index, uint32_t operand, bool is_dirty) {
+    uint8_t bit = 1 << (index & (cache->line_words - 1));
+    uint8_t *dirty_mask = &cache->dirty_masks[index >> cache->line_bits];
+    cache->operands[index] = operand;
+    *dirty_mask = (*dirty_mask & ~bit) | (-(uint8_t)is_dirty & bit);
+}
+
+// Compares the line against the tags of count slots from first on, one vector compare per chunk
+static inline uint64_t match_tags(const Cache *cache, uint8_t first, uint8_t count, uint32_t line) {
+    const uint32_t *tags = cache->tags + first;
+    uint64_t matches = 0;
+    uint8_t i = 0;
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi32((int32_t)line);
+    for (; i + 8 <= count; i += 8) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(tags + i));
+        matches |= (uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(chunk, needle))) << i;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i narrow_needle = _mm_set1_epi32((int32_t)line);
+    for (; i + 4 <= count; i += 4) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(tags + i));
+        matches |= (uint64_t)(uint8_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(chunk, narrow_needle))) << i;
+    }
+#endif
+    for (; i < count; i++) {
+        matches |= (uint64_t)(tags[i] == line) << i; // Sets smaller than a vector
+    }
+    return matches;
+}
+
+// Compares the tags of all ways of a set at once, returns a bitmask of the matching ways
+static inline uint64_t match_ways(const Cache *cache, uint8_t set, uint32_t address) {
+    uint8_t first = set << cache->way_bits;
+    uint64_t matches = match_tags(cache, first, cache->ways, address >> cache->line_bits);
+    return matches & (cache->valid_mask >> first) & get_way_mask(cache); // Empty slots never match
+}
+
+static void touch_way(Cache *cache, uint8_t set, uint8_t way) {
+    uint8_t *ages = cache->ages + ((uint16_t)set << cache->way_bits);
+    uint16_t node;
+    switch (cache->policy) {
+        case POLICY_LRU:
+            for (uint8_t i = 0; i < cache->ways; i++) {
+                ages[i] += ages[i] < ages[way]; // Everything younger than the used way ages by one
+            }
+            ages[way] = 0;
+            break;
+        case POLICY_PLRU:
+            // Walk up the tree and point every node away from the used way
+            for (node = way + cache->ways; node > 1; node >>= 1) {
+                if (node & 1) {
+                    cache->set_states[set] &= ~(1ULL << (node >> 1));
+                } else {
+                    cache->set_states[set] |= 1ULL << (node >> 1);
+                }
+            }
+            break;
+        default: // FIFO and random don't care about hits
+            break;
+    }
+}
+
+static uint8_t choose_victim(Cache *cache, uint8_t set) {
+    const uint8_t *ages = cache->ages + ((uint16_t)set << cache->way_bits);
+    uint64_t free_ways = ~(cache->valid_mask >> ((uint16_t)set << cache->way_bits)) & get_way_mask(cache);
+    uint8_t victim = 0;
+    uint16_t node = 1;
+    if (free_ways) {
+        return __builtin_ctzll(free_ways); // Always fill empty ways first
+    }
+    switch (cache->policy) {
+        case POLICY_LRU:
+            for (uint8_t way = 1; way < cache->ways; way++) {
+                if (ages[way] > ages[victim]) victim = way;
+            }
+            break;
+        case POLICY_PLRU:
+            while (node < cache->ways) {
+                node = (node << 1) | ((cache->set_states[set] >> node) & 1);
+            }
+            victim = node - cache->ways;
+            break;
+        case POLICY_FIFO:
+            victim = (uint8_t)cache->set_states[set];
+            break;
+        case POLICY_RANDOM:
+            cache->random_state ^= cache->random_state << 13; // xorshift32
+            cache->random_state ^= cache->random_state >> 17;
+            cache->random_state ^= cache->random_state << 5;
+            victim = cache->random_state & (cache->ways - 1);
+            break;
+    }
+    return victim;
+}
+
+static uint32_t read_ram_operand(const Cache *cache, uint32_t address) {
+    uint64_t ram_index = (uint64_t)address * cache->instruction_size;
+    uint32_t operand = 0;
+    if (!cache->ram || ram_index + cache->instruction_size > cache->ram_size) {
+        return 0; // The aligned block can reach past the end of RAM
+    }
+    // Stores still waiting in the write buffer are newer than RAM
+    const Cache *top = cache;
+    while (top->upper_level) top = top->upper_level;
+    for (uint8_t i = 0; i < top->write_buffer_count; i++) {
+        if ((uint32_t)(top->write_buffer[i] >> 32) == address) return (uint32_t)top->write_buffer[i];
+    }
+    memcpy(&operand, cache->ram + ram_index + 1, cache->instruction_size - 1);
+    return (uint32_t)sign_extend_i32(operand, cache->instruction_size - 1);
+}
+
+// A line in transit between two levels
+typedef struct {
+    uint32_t operands[MAX_LINE_WORDS];
+    uint8_t dirty; // One bit per word
+} CacheLine;
+
+static bool lookup_line(const Cache *cache, uint32_t address, uint8_t *slot) {
+    uint8_t set = get_set(cache, address);
+    uint64_t matches = match_ways(cache, set, address);
+    if (!matches) {
+        return false;
+    }
+    *slot = (set << cache->way_bits) | __builtin_ctzll(matches);
+    return true;
+}
+
+static void read_line(const Cache *cache, uint8_t slot, CacheLine *line) {
+    memcpy(line->operands, cache->operands + ((uint16_t)slot << cache->line_bits), cache->line_words * sizeof(uint32_t));
+    line->dirty = cache->dirty_masks[slot];
+}
+
+static inline Cache *get_first_level(Cache *cache) {
+    while (cache->upper_level) cache = cache->upper_level;
+    return cache;
+}
+
+// RAM writes are reported by the first level, that is the one the emulator talks to
+static void commit_ram_word(Cache *top, uint64_t cache_entry) {
+    writeback_cache_entry(top, top->ram, cache_entry, top->instruction_size);
+    top->ram_writes++;
+    if (top->evicted_count < MAX_LINE_WORDS + 1) top->evicted[top->evicted_count++] = cache_entry;
+}
+
+static void drain_write_buffer(Cache *top) {
+    commit_ram_word(top, top->write_buffer[0]);
+    top->write_buffer_count--;
+    memmove(top->write_buffer, top->write_buffer + 1, top->write_buffer_count * sizeof(uint64_t));
+}
+
+// Everything headed for RAM passes the write buffer, a store to a waiting address replaces it
+static void write_ram_word(Cache *cache, uint64_t cache_entry) {
+    Cache *top = get_first_level(cache);
+    if (top->write_buffer_size == 0) {
+        commit_ram_word(top, cache_entry);
+        return;
+    }
+    for (uint8_t i = 0; i < top->write_buffer_count; i++) {
+        if ((top->write_buffer[i] >> 32) == (cache_entry >> 32)) {
+            top->write_buffer[i] = cache_entry;
+            top->coalesced_writes++;
+            return;
+        }
+    }
+    if (top->write_buffer_count == top->write_buffer_size) {
+        drain_write_buffer(top);
+    }
+    top->write_buffer[top->write_buffer_count++] = cache_entry;
+}
+
+// *** Statistics ***
+
+static bool touch_shadow(Cache *cache, uint32_t line_address) {
+    uint8_t i = 0;
+    while (i < cache->shadow_count && cache->shadow_lines[i] != line_address) i++;
+    bool is_hit = i < cache->shadow_count;
+    if (!is_hit) {
+        cache->shadow_count += cache->shadow_count < cache->size;
+        i = cache->shadow_count - 1; // The least recently used line falls out
+    }
+    memmove(cache->shadow_lines + 1, cache->shadow_lines, i * sizeof(uint32_t));
+    cache->shadow_lines[0] = line_address;
+    return is_hit;
+}
+
+static void count_access(CacheCounters *counters, bool is_hit, bool is_seen, bool is_shadow_hit, bool is_invalidated) {
+    if (is_hit) {
+        counters->hits++;
+        return;
+    }
+    counters->misses++;
+    if (is_invalidated) {
+        counters->coherence_misses++;
+    } else if (!is_seen) {
+        counters->compulsory_misses++;
+    } else if (!is_shadow_hit) {
+        counters->capacity_misses++;
+    } else {
+        counters->conflict_misses++;
+    }
+}
+
+// Counts a demand access to this level, misses are classified as compulsory, capacity, conflict or coherence
+// Counters of the instruction causing the access, or of the fetch stream
+static CacheCounters *get_source_counters(Cache *cache) {
+    const Cache *first = get_first_level(cache);
+    return first->is_fetching ? &cache->fetch_counters : &cache->opcode_counters[first->access_opcode];
+}
+
+static void record_access(Cache *cache, uint32_t line_address, bool is_hit) {
+    uint64_t line = line_address >> cache->line_bits;
+    bool is_seen = line < cache->seen_lines_count && (cache->seen_lines[line >> 6] >> (line & 63)) & 1;
+    bool is_invalidated = false;
+    bool is_shadow_hit = touch_shadow(cache, line_address);
+    if (line < cache->seen_lines_count) {
+        cache->seen_lines[line >> 6] |= 1ULL << (line & 63);
+    }
+    if (cache->invalidated_lines && line < cache->seen_lines_count) {
+        is_invalidated = (cache->invalidated_lines[line >> 6] >> (line & 63)) & 1;
+        cache->invalidated_lines[line >> 6] &= ~(1ULL << (line & 63));
+    }
+    count_access(&cache->counters, is_hit, is_seen, is_shadow_hit, is_invalidated);
+    count_access(get_source_counters(cache), is_hit, is_seen, is_shadow_hit, is_invalidated);
+}
+
+static void record_eviction(Cache *cache, uint8_t dirty) {
+    CacheCounters *opcode_counters = get_source_counters(cache);
+    if (dirty) {
+        cache->counters.dirty_evictions++;
+        cache->counters.writebacks += __builtin_popcount(dirty);
+        opcode_counters->dirty_evictions++;
+        opcode_counters->writebacks += __builtin_popcount(dirty);
+    }
+}
+
+static uint8_t install_line(Cache *cache, uint32_t line_address, const CacheLine *line);
+
+// Removes a line, only its dirty words go down to the next level or RAM
+static void evict_line(Cache *cache, uint8_t slot) {
+    if (!is_slot_valid(cache, slot)) {
+        return;
+    }
+    uint32_t line_address = get_word_address(cache, (uint16_t)slot << cache->line_bits);
+    Cache *upper = cache->upper_level;
+    Cache *below = cache->next_level;
+    uint8_t other_slot;
+    CacheLine line;
+    read_line(cache, slot, &line);
+    cache->valid_mask &= ~(1ULL << slot);
+    if (cache->prefetcher && (cache->prefetcher->pending_mask >> slot) & 1) {
+        cache->prefetcher->polluting++; // Prefetched for nothing and took the place of another line
+        cache->prefetcher->pending_mask &= ~(1ULL << slot);
+    }
+
+    // Inclusion: the copy above has to go as well, its dirty words are newer than ours
+    if (upper && !upper->exclusive && lookup_line(upper, line_address, &other_slot)) {
+        CacheLine upper_line;
+        read_line(upper, other_slot, &upper_line);
+        for (uint8_t word = 0; word < cache->line_words; word++) {
+            if (upper_line.dirty & (1 << word)) line.operands[word] = upper_line.operands[word];
+        }
+        line.dirty |= upper_line.dirty;
+        upper->valid_mask &= ~(1ULL << other_slot);
+    }
+    record_eviction(cache, line.dirty);
+
+    if (below && (cache->exclusive || !lookup_line(below, line_address, &other_slot))) {
+        install_line(below, line_address, &line); // Exclusive victims move down whole
+    } else if (below) {
+        for (uint8_t word = 0; word < cache->line_words; word++) {
+            if (line.dirty & (1 << word)) {
+                below->operands[((uint16_t)other_slot << below->line_bits) | word] = line.operands[word];
+            }
+        }
+        below->dirty_masks[other_slot] |= line.dirty;
+    } else {
+        for (uint8_t word = 0; word < cache->line_words; word++) {
+            if (line.dirty & (1 << word)) {
+                write_ram_word(cache, ((uint64_t)(line_address + word) << 32) | line.operands[word]);
+            }
+        }
+    }
+}
+
+// Places a whole line into a free or victim way of its set
+static uint8_t install_line(Cache *cache, uint32_t line_address, const CacheLine *line) {
+    uint8_t set = get_set(cache, line_address);
+    uint8_t way = choose_victim(cache, set);
+    uint8_t slot = (set << cache->way_bits) | way;
+    evict_line(cache, slot);
+    if (cache->prefetcher) {
+        cache->prefetcher->pending_mask &= ~(1ULL << slot);
+    }
+    memcpy(cache->operands + ((uint16_t)slot << cache->line_bits), line->operands, cache->line_words * sizeof(uint32_t));
+    cache->dirty_masks[slot] = line->dirty;
+    cache->tags[slot] = line_address >> cache->line_bits;
+    cache->valid_mask |= 1ULL << slot;
+    touch_way(cache, set, way);
+    if (cache->policy == POLICY_FIFO) {
+        cache->set_states[set] = (way + 1) & (cache->ways - 1);
+    }
+    return slot;
+}
+
+// Gathers the whole aligned block from the level below, RAM at the bottom
+static void fetch_line(Cache *cache, uint32_t line_address, CacheLine *line) {
+    Cache *below = cache->next_level;
+    uint8_t slot;
+    line->dirty = 0;
+    if (!below) {
+        for (uint8_t word = 0; word < cache->line_words; word++) {
+            line->operands[word] = read_ram_operand(cache, line_address + word);
+        }
+        return;
+    }
+    if (lookup_line(below, line_address, &slot)) {
+        record_access(below, line_address, true);
+        read_line(below, slot, line);
+        if (cache->exclusive) {
+            below->valid_mask &= ~(1ULL << slot); // The line moves up together with its dirty words
+        } else {
+            touch_way(below, slot >> below->way_bits, slot & (below->ways - 1));
+            line->dirty = 0; // The copy below stays responsible for them
+        }
+        return;
+    }
+    record_access(below, line_address, false);
+    fetch_line(below, line_address, line);
+    if (!cache->exclusive) {
+        install_line(below, line_address, line);
+    }
+}
+
+// Simulates an access on the tags alone, the lines never carry data or get dirty
+bool access_cache_tags(Cache *cache, uint32_t address) {
+    static const CacheLine empty_line = {0};
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    uint8_t slot;
+    bool is_hit = lookup_line(cache, address, &slot);
+    record_access(cache, line_address, is_hit);
+    if (is_hit) {
+        touch_way(cache, slot >> cache->way_bits, slot & (cache->ways - 1));
+    } else {
+        install_line(cache, line_address, &empty_line);
+    }
+    return is_hit;
+}
+
+// Counts an access whose outcome a replay decided on its own, the misses are classified like those of the cache
+void record_cache_access(Cache *cache, uint32_t address, bool is_hit) {
+    record_access(cache, address & ~(uint32_t)(cache->line_words - 1), is_hit);
+}
+
+// Installs the lines the previous first level held, least recently used first, its dirty words have to be flushed already
+void rewarm_cache(Cache *cache, const Cache *previous) {
+    for (int16_t age = previous->ways - 1; age >= 0; age--) {
+        for (uint8_t slot = 0; slot < previous->size; slot++) {
+            if (!is_slot_valid(previous, slot) || previous->ages[slot] != age) continue;
+            uint32_t line_address = get_word_address(previous, (uint16_t)slot << previous->line_bits);
+            for (uint8_t word = 0; word < previous->line_words; word++) {
+                add_to_cache(cache, line_address + word, read_ram_operand(cache, line_address + word), false);
+            }
+        }
+    }
+    reset_cache_stats(cache); // Warming isn't part of the program
+}
+
+// Shadow caches and the reuse distances don't depend on the geometry, a reconfigured cache keeps them
+void move_cache_observers(Cache *to, Cache *from) {
+    for (uint8_t i = 0; i < to->shadow_cache_count; i++) {
+        free_cache(to->shadow_caches[i]);
+    }
+    free(to->shadow_caches);
+    to->shadow_caches = from->shadow_caches;
+    to->shadow_cache_count = from->shadow_cache_count;
+    from->shadow_caches = NULL;
+    from->shadow_cache_count = 0;
+    if (from->reuse) {
+        ReuseAnalyzer *reuse = to->reuse;
+        to->reuse = from->reuse;
+        from->reuse = reuse; // Freed together with the old cache
+    }
+}
+
+// *** Coherence ***
+
+CoherenceBus *create_coherence_bus(Cache **caches, uint8_t cache_count) {
+    CoherenceBus *bus = malloc(sizeof(CoherenceBus));
+    if (!bus || !(bus->cache_mutexes = malloc(cache_count * sizeof(mutex_t)))) {
+        perror("Failed to allocate memory for the coherence bus");
+        exit(EXIT_FAILURE);
+    }
+    mutex_init(&bus->mutex);
+    bus->caches = caches;
+    bus->cache_count = cache_count;
+    for (uint8_t hart = 0; hart < cache_count; hart++) {
+        Cache *cache = caches[hart];
+        if (cache->next_level || cache->write_policy != WRITE_BACK || !cache->write_allocate || cache->write_buffer_size || cache->prefetcher) {
+            fprintf(stderr, "Coherent caches have to be a single write-back, write-allocate level without write buffer or prefetcher.\n");
+            exit(EXIT_FAILURE);
+        }
+        mutex_init(&bus->cache_mutexes[hart]);
+        cache->bus = bus;
+        cache->hart = hart;
+        cache->invalidated_lines = calloc(((cache->seen_lines_count + 63) >> 6) + 1, sizeof(uint64_t));
+        if (!cache->invalidated_lines) {
+            perror("Failed to allocate memory for the invalidated lines");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return bus;
+}
+
+void free_coherence_bus(CoherenceBus *bus) {
+    if (bus) {
+        for (uint8_t hart = 0; hart < bus->cache_count; hart++) {
+            bus->caches[hart]->bus = NULL;
+        }
+        free(bus->cache_mutexes);
+        free(bus);
+    }
+}
+
+// Another hart wants the line, a modified copy goes to RAM first so the requester fills the newest words
+static bool snoop_line(Cache *cache, uint32_t line_address, bool is_invalidating) {
+    uint8_t slot;
+    if (!lookup_line(cache, line_address, &slot)) {
+        return false;
+    }
+    for (uint8_t dirty = cache->dirty_masks[slot]; dirty; dirty &= dirty - 1) {
+        uint16_t index = ((uint16_t)slot << cache->line_bits) | __builtin_ctz(dirty);
+        write_ram_word(cache, ((uint64_t)get_word_address(cache, index) << 32) | cache->operands[index]);
+    }
+    cache->coherence.interventions += cache->dirty_masks[slot] != 0;
+    cache->dirty_masks[slot] = 0;
+    if (is_invalidating) {
+        uint64_t line = line_address >> cache->line_bits;
+        cache->valid_mask &= ~(1ULL << slot);
+        cache->shared_mask &= ~(1ULL << slot);
+        if (line < cache->seen_lines_count) {
+            cache->invalidated_lines[line >> 6] |= 1ULL << (line & 63);
+        }
+        cache->coherence.invalidations++;
+    } else {
+        cache->shared_mask |= 1ULL << slot; // M and E become S
+    }
+    return true;
+}
+
+// Only called with the bus held, so no other transaction can change the caches in between
+static bool broadcast(Cache *cache, uint32_t address, bool is_invalidating) {
+    CoherenceBus *bus = cache->bus;
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    bool is_shared = false;
+    for (uint8_t hart = 0; hart < bus->cache_count; hart++) {
+        if (hart == cache->hart) continue;
+        mutex_lock(&bus->cache_mutexes[hart]);
+        is_shared |= snoop_line(bus->caches[hart], line_address, is_invalidating);
+        mutex_unlock(&bus->cache_mutexes[hart]);
+    }
+    return is_shared;
+}
+
+// Hits in any valid state stay private to the hart, a miss reads the line as E or, if another cache has it, as S
+uint32_t coherent_load(Cache *cache, uint32_t address) {
+    mutex_t *own_mutex = &cache->bus->cache_mutexes[cache->hart];
+    uint8_t slot;
+    uint32_t operand;
+    mutex_lock(own_mutex);
+    if (lookup_line(cache, address, &slot)) {
+        operand = get_u32_from_cache_or_ram(cache, cache->ram, address, cache->instruction_size);
+        mutex_unlock(own_mutex);
+        return operand;
+    }
+    mutex_unlock(own_mutex);
+
+    mutex_lock(&cache->bus->mutex);
+    cache->coherence.bus_reads++;
+    bool is_shared = broadcast(cache, address, false);
+    mutex_lock(own_mutex);
+    operand = get_u32_from_cache_or_ram(cache, cache->ram, address, cache->instruction_size);
+    slot = cache->last_word >> cache->line_bits;
+    cache->shared_mask = (cache->shared_mask & ~(1ULL << slot)) | ((uint64_t)is_shared << slot);
+    mutex_unlock(own_mutex);
+    mutex_unlock(&cache->bus->mutex);
+    return operand;
+}
+
+// Stores hit privately in E and M, a shared line is upgraded and a miss reads the line for ownership
+void coherent_store(Cache *cache, uint32_t address, uint32_t operand) {
+    mutex_t *own_mutex = &cache->bus->cache_mutexes[cache->hart];
+    uint8_t slot;
+    mutex_lock(own_mutex);
+    if (lookup_line(cache, address, &slot) && !((cache->shared_mask >> slot) & 1)) {
+        store_to_cache(cache, address, operand);
+        mutex_unlock(own_mutex);
+        return;
+    }
+    mutex_unlock(own_mutex);
+
+    mutex_lock(&cache->bus->mutex);
+    if (lookup_line(cache, address, &slot)) {
+        cache->coherence.upgrades++;
+    } else {
+        cache->coherence.bus_read_exclusives++;
+    }
+    broadcast(cache, address, true);
+    mutex_lock(own_mutex);
+    store_to_cache(cache, address, operand);
+    cache->shared_mask &= ~(1ULL << (cache->last_word >> cache->line_bits));
+    mutex_unlock(own_mutex);
+    mutex_unlock(&cache->bus->mutex);
+}
+
+void print_coherence_stats(const Cache *cache) {
+    const CoherenceCounters *coherence = &cache->coherence;
+    printf("MESI    : %" PRIu64 " bus reads, %" PRIu64 " read-exclusives, %" PRIu64 " upgrades, %" PRIu64 " invalidations received, %" PRIu64 " interventions, %" PRIu64 " coherence misses\n",
+           coherence->bus_reads, coherence->bus_read_exclusives, coherence->upgrades, coherence->invalidations, coherence->interventions,
+           cache->counters.coherence_misses);
+}
+
+// *** Reuse distance ***
+
+void set_reuse_analyzer(Cache *cache, bool enabled) {
+    if (!enabled || cache->reuse) {
+        return;
+    }
+    ReuseAnalyzer *reuse = calloc(1, sizeof(ReuseAnalyzer));
+    if (!reuse) {
+        perror("Failed to allocate memory for the reuse distance analyzer");
+        exit(EXIT_FAILURE);
+    }
+    reuse->capacity = MIN_REUSE_CAPACITY;
+    reuse->time = 1;
+    reuse->tree = calloc(reuse->capacity + 1, sizeof(uint64_t));
+    reuse->time_lines = malloc((reuse->capacity + 1) * sizeof(uint32_t));
+    if (!reuse->tree || !reuse->time_lines) {
+        perror("Failed to allocate memory for the reuse distance tree");
+        exit(EXIT_FAILURE);
+    }
+    cache->reuse = reuse;
+    attach_cache_ram(cache, cache->ram, cache->ram_size, cache->instruction_size); // Sizes the per line times
+}
+
+static inline void add_reuse_mark(ReuseAnalyzer *reuse, uint64_t time, int64_t delta) {
+    for (; time <= reuse->capacity; time += time & (~time + 1)) reuse->tree[time] += delta;
+}
+
+static inline uint64_t count_reuse_marks(const ReuseAnalyzer *reuse, uint64_t time) {
+    uint64_t count = 0;
+    for (; time > 0; time -= time & (~time + 1)) count += reuse->tree[time];
+    return count;
+}
+
+// Only the last access of every line keeps its mark, so they are renumbered 1..distinct_lines in order
+static void compact_reuse_times(ReuseAnalyzer *reuse) {
+    uint64_t next_time = 1;
+    for (uint64_t time = 1; time < reuse->time; time++) {
+        uint32_t line = reuse->time_lines[time];
+        if (reuse->last_times[line] == time) {
+            reuse->last_times[line] = next_time;
+            reuse->time_lines[next_time++] = line;
+        }
+    }
+    if (reuse->distinct_lines > reuse->capacity / 2) {
+        reuse->capacity <<= 1;
+        uint64_t *tree = realloc(reuse->tree, (reuse->capacity + 1) * sizeof(uint64_t));
+        uint32_t *time_lines = tree ? realloc(reuse->time_lines, (reuse->capacity + 1) * sizeof(uint32_t)) : NULL;
+        if (!tree || !time_lines) {
+            perror("Failed to grow the reuse distance tree");
+            exit(EXIT_FAILURE);
+        }
+        reuse->tree = tree;
+        reuse->time_lines = time_lines;
+    }
+    // Linear Fenwick build over the marks that are left
+    memset(reuse->tree, 0, (reuse->capacity + 1) * sizeof(uint64_t));
+    for (uint64_t time = 1; time <= reuse->capacity; time++) {
+        reuse->tree[time] += time < next_time;
+        uint64_t parent = time + (time & (~time + 1));
+        if (parent <= reuse->capacity) reuse->tree[parent] += reuse->tree[time];
+    }
+    reuse->time = next_time;
+}
+
+static void record_reuse(ReuseAnalyzer *reuse, uint32_t line) {
+    if (line >= reuse->line_count) {
+        return; // Outside of RAM, the load itself fails
+    }
+    if (reuse->time > reuse->capacity) {
+        compact_reuse_times(reuse);
+    }
+    uint64_t last_time = reuse->last_times[line];
+    reuse->accesses++;
+    if (last_time) {
+        uint64_t distance = reuse->distinct_lines - count_reuse_marks(reuse, last_time); // Lines touched after it
+        reuse->histogram[distance < REUSE_HISTOGRAM_SIZE ? distance : REUSE_HISTOGRAM_SIZE]++;
+        add_reuse_mark(reuse, last_time, -1);
+    } else {
+        reuse->cold_accesses++;
+        reuse->distinct_lines++;
+    }
+    add_reuse_mark(reuse, reuse->time, 1);
+    reuse->time_lines[reuse->time] = line;
+    reuse->last_times[line] = reuse->time++;
+}
+
+// A fully associative LRU cache of the given lines hits exactly the accesses with a shorter distance
+static uint64_t get_reuse_misses(const ReuseAnalyzer *reuse, uint64_t lines) {
+    uint64_t misses = reuse->cold_accesses;
+    for (uint64_t distance = lines < REUSE_HISTOGRAM_SIZE ? lines : REUSE_HISTOGRAM_SIZE; distance <= REUSE_HISTOGRAM_SIZE; distance++) {
+        misses += reuse->histogram[distance];
+    }
+    return misses;
+}
+
+void print_reuse_histogram(const ReuseAnalyzer *reuse, uint8_t line_words) {
+    printf("Reuse distance (%u word lines): %" PRIu64 " accesses, %" PRIu64 " cold\n", line_words, reuse->accesses, reuse->cold_accesses);
+    for (uint64_t low = 0, high = 1; low < REUSE_HISTOGRAM_SIZE; low = high, high <<= 1) {
+        uint64_t count = 0;
+        for (uint64_t distance = low; distance < high; distance++) count += reuse->histogram[distance];
+        if (count) printf("  [%" PRIu64 ", %" PRIu64 "): %" PRIu64 "\n", low, high, count);
+    }
+    if (reuse->histogram[REUSE_HISTOGRAM_SIZE]) {
+        printf("  [%u, inf): %" PRIu64 "\n", REUSE_HISTOGRAM_SIZE, reuse->histogram[REUSE_HISTOGRAM_SIZE]);
+    }
+    printf("Fully associative LRU miss ratio:");
+    for (uint64_t lines = 1; lines <= REUSE_HISTOGRAM_SIZE; lines <<= 1) {
+        printf(" %" PRIu64 ": %.2f%%", lines, reuse->accesses ? 100.0 * get_reuse_misses(reuse, lines) / reuse->accesses : 0.0);
+    }
+    printf("\n");
+    printf("Accesses a cache beyond %u lines would hit: %" PRIu64 "\n", MAX_CACHE_SIZE, get_reuse_misses(reuse, MAX_CACHE_SIZE) - reuse->cold_accesses);
+}
+
+bool write_reuse_json(const ReuseAnalyzer *reuse, uint8_t line_words, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "{\n  \"line_words\": %u,\n  \"accesses\": %" PRIu64 ",\n  \"cold\": %" PRIu64 ",\n  \"histogram\": [", line_words, reuse->accesses, reuse->cold_accesses);
+    for (uint16_t distance = 0; distance < REUSE_HISTOGRAM_SIZE; distance++) {
+        fprintf(file, "%s%" PRIu64, distance ? ", " : "", reuse->histogram[distance]);
+    }
+    fprintf(file, "],\n  \"beyond\": %" PRIu64 ",\n  \"max_cache_size\": %u,\n  \"miss_ratio\": {", reuse->histogram[REUSE_HISTOGRAM_SIZE], MAX_CACHE_SIZE);
+    for (uint64_t lines = 1; lines <= REUSE_HISTOGRAM_SIZE; lines <<= 1) {
+        fprintf(file, "%s\"%" PRIu64 "\": %.6f", lines > 1 ? ", " : "", lines, reuse->accesses ? (double)get_reuse_misses(reuse, lines) / reuse->accesses : 0.0);
+    }
+    fprintf(file, "}\n}\n");
+    return fclose(file) == 0;
+}
+
+// Everything that watches the demand accesses of the first level without taking part in them
+static void observe_access(Cache *cache, uint32_t address) {
+    for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+        access_cache_tags(cache->shadow_caches[i], address);
+    }
+    if (cache->reuse) {
+        record_reuse(cache->reuse, address >> cache->line_bits);
+    }
+}
+
+// Brings the line of the address into the cache and points last_word at the word
+static bool access_line(Cache *cache, uint32_t address) {
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    uint8_t slot;
+    bool is_hit = lookup_line(cache, address, &slot);
+    record_access(cache, line_address, is_hit);
+    observe_access(cache, address);
+    if (is_hit) {
+        touch_way(cache, slot >> cache->way_bits, slot & (cache->ways - 1));
+        if (cache->prefetcher && (cache->prefetcher->pending_mask >> slot) & 1) {
+            Prefetcher *prefetcher = cache->prefetcher;
+            prefetcher->useful++;
+            prefetcher->late += prefetcher->tick - prefetcher->issue_ticks[slot] < PREFETCH_LATENCY;
+            prefetcher->pending_mask &= ~(1ULL << slot);
+        }
+    } else {
+        CacheLine line;
+        fetch_line(cache, line_address, &line);
+        slot = install_line(cache, line_address, &line);
+    }
+    cache->last_word = ((uint16_t)slot << cache->line_bits) | (address & (cache->line_words - 1));
+    return is_hit;
+}
+
+// *** Prefetching ***
+
+static inline bool is_in_ram(const Cache *cache, uint32_t line_address) {
+    return (uint64_t)line_address * cache->instruction_size < cache->ram_size;
+}
+
+static void issue_prefetch(Cache *cache, uint32_t address) {
+    Prefetcher *prefetcher = cache->prefetcher;
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    uint8_t slot;
+    CacheLine line;
+    if (!is_in_ram(cache, line_address) || lookup_line(cache, line_address, &slot)) {
+        return; // Nothing to fetch
+    }
+    fetch_line(cache, line_address, &line);
+    slot = install_line(cache, line_address, &line);
+    prefetcher->pending_mask |= 1ULL << slot;
+    prefetcher->issue_ticks[slot] = prefetcher->tick;
+    prefetcher->issued++;
+}
+
+static void push_stream_line(Cache *cache, uint32_t line_address) {
+    Prefetcher *prefetcher = cache->prefetcher;
+    if (!is_in_ram(cache, line_address)) {
+        return;
+    }
+    prefetcher->stream_buffer[prefetcher->stream_count] = line_address;
+    prefetcher->stream_ticks[prefetcher->stream_count++] = prefetcher->tick;
+    prefetcher->issued++;
+}
+
+// A miss on the head of the stream buffer is served from it, the stream then runs one line further
+static void take_from_stream_buffer(Cache *cache, uint32_t address) {
+    Prefetcher *prefetcher = cache->prefetcher;
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    CacheLine line;
+    if (prefetcher->stream_count == 0 || prefetcher->stream_buffer[0] != line_address) {
+        return;
+    }
+    prefetcher->useful++;
+    prefetcher->late += prefetcher->tick - prefetcher->stream_ticks[0] < PREFETCH_LATENCY;
+    fetch_line(cache, line_address, &line);
+    install_line(cache, line_address, &line);
+    prefetcher->stream_count--;
+    memmove(prefetcher->stream_buffer, prefetcher->stream_buffer + 1, prefetcher->stream_count * sizeof(uint32_t));
+    memmove(prefetcher->stream_ticks, prefetcher->stream_ticks + 1, prefetcher->stream_count * sizeof(uint64_t));
+    line_address = prefetcher->stream_count ? prefetcher->stream_buffer[prefetcher->stream_count - 1] : line_address;
+    push_stream_line(cache, line_address + cache->line_words);
+}
+
+// Trains on a demand load once its value has been read
+static void run_prefetcher(Cache *cache, uint32_t address, bool is_hit) {
+    Prefetcher *prefetcher = cache->prefetcher;
+    uint32_t line_address = address & ~(uint32_t)(cache->line_words - 1);
+    StrideEntry *entry;
+    uint32_t key;
+    int32_t stride;
+    switch (prefetcher->kind) {
+        case PREFETCH_NEXT_LINE:
+            issue_prefetch(cache, line_address + cache->line_words);
+            break;
+        case PREFETCH_STRIDE:
+            // Both loads of an indirect instruction get their own entry
+            key = (cache->access_pc << 1) | (cache->access_index & 1);
+            entry = &prefetcher->stride_table[key & (STRIDE_TABLE_SIZE - 1)];
+            if (entry->key != key) {
+                *entry = (StrideEntry){.key = key, .last_address = address};
+                break;
+            }
+            stride = (int32_t)(address - entry->last_address);
+            if (stride != 0 && stride == entry->stride) {
+                entry->confidence += entry->confidence < 3;
+            } else {
+                entry->stride = stride;
+                entry->confidence = 0;
+            }
+            entry->last_address = address;
+            if (entry->confidence > 0) {
+                // Small strides would stay in the same line, so go to the neighbouring one instead
+                issue_prefetch(cache, abs(stride) < cache->line_words ? address + (stride > 0 ? cache->line_words : -cache->line_words) : address + stride);
+            }
+            break;
+        case PREFETCH_STREAM:
+            // The second load of LDA_IND is the pointer target, a miss there starts a new stream
+            if (!is_hit && cache->access_opcode == LDA_IND && cache->access_index == 1) {
+                prefetcher->polluting += prefetcher->stream_count;
+                prefetcher->stream_count = 0;
+                for (uint8_t i = 1; i <= STREAM_BUFFER_SIZE; i++) {
+                    push_stream_line(cache, line_address + i * cache->line_words);
+                }
+            }
+            break;
+    }
+}
+
 bool will_overwrite_entry(Cache *cache, uint32_t address) {
-    uint8_t index = get_cache_index(cache->cache_bits, address);
-    uint32_t stored_address = (uint32_t)((cache->entries[index] >> 32 + cache->cache_bits) << cache->cache_bits); // Extract the stored address
-    return cache->entries[index] != 0 && (stored_address | index) != address; // True if non-zero and different address
+    uint8_t set = get_set(cache, address);
+    if (match_ways(cache, set, address)) return false;
+    // True if there is no free way left
+    return (~(cache->valid_mask >> ((uint16_t)set << cache->way_bits)) & get_way_mask(cache)) == 0;
 }
 
 uint64_t find_in_cache(Cache *cache, uint32_t address) {
-    uint8_t index = get_cache_index(cache->cache_bits, address);
-    uint64_t entry = cache->entries[index];
-    uint32_t stored_address = (uint32_t)(entry >> 32 + cache->cache_bits) << cache->cache_bits; // Extract the stored address
-    if ((stored_address | index) == address) {
-        return (uint64_t)(uint32_t)entry; // Cache hit (discard the address)
+    uint8_t slot;
+    if (lookup_line(cache, address, &slot)) {
+        cache->last_word = ((uint16_t)slot << cache->line_bits) | (address & (cache->line_words - 1));
+        touch_way(cache, slot >> cache->way_bits, slot & (cache->ways - 1));
+        return cache->operands[cache->last_word]; // Cache hit
     }
-    return UINT32_MAX + 1; // Cache miss
+    return (uint64_t)UINT32_MAX + 1; // Cache miss, past every operand
 }
 
-uint64_t add_to_cache(Cache *cache, uint32_t address, uint32_t operand, bool as_dirty, bool *is_valid_result) {
-    uint8_t index = get_cache_index(cache->cache_bits, address);
+uint8_t add_to_cache(Cache *cache, uint32_t address, uint32_t operand, bool as_dirty) {
+    cache->evicted_count = 0;
+    bool is_hit = access_line(cache, address);
 
-    uint64_t old_entry = cache->entries[index];
-    uint32_t remaining_address = (uint32_t)(old_entry >> 32 + cache->cache_bits);
-    uint32_t stored_address = (remaining_address << cache->cache_bits) | index;
-    uint32_t stored_operand = (uint32_t)(old_entry & 0xFFFFFFFF);
-    bool is_dirty = old_entry & (1ULL << 32);
+    // A cached word becomes dirty once its operand changes, a new one only if asked to
+    bool is_dirty = is_word_dirty(cache, cache->last_word) | (is_hit ? cache->operands[cache->last_word] != operand : as_dirty);
+    set_word(cache, cache->last_word, operand, is_dirty);
+    return cache->evicted_count;
+}
+
+// A split I-cache has no RAM and only tracks tags, a unified cache brings the code cells in like a load.
+// A dirty data line it evicts is written back like on a load, the FETCH counters get the blame.
+bool fetch_instruction(Cache *cache, uint32_t address) {
+    if (!cache->ram) {
+        return access_cache_tags(cache, address);
+    }
+    cache->evicted_count = 0;
+    cache->is_fetching = true;
+    bool is_hit = access_line(cache, address);
+    cache->is_fetching = false;
+    return is_hit;
+}
 
-    if (stored_address == address && stored_operand == operand) {
-        return 0; // No change, no overwrite
+// Hands a store the first level doesn't keep dirty to the levels below, RAM at the bottom
+static void write_below(Cache *cache, uint32_t address, uint32_t operand) {
+    bool is_write_back = cache->write_policy == WRITE_BACK;
+    uint8_t slot;
+    for (Cache *below = cache->next_level; below; below = below->next_level) {
+        if (lookup_line(below, address, &slot)) {
+            set_word(below, ((uint16_t)slot << below->line_bits) | (address & (below->line_words - 1)), operand, is_write_back);
+            if (is_write_back) return; // The level below writes it back once the line leaves
+        }
     }
+    write_ram_word(cache, ((uint64_t)address << 32) | operand);
+}
 
-    // If the addresses are different or the operand has changed, create a new entry
-    uint64_t new_entry = (((uint64_t)address >> 1) << 33) | operand;
-    if (stored_address == address) {
-        // If the address matches but the operand changed, mark as dirty
-        new_entry |= (1ULL << 32);
-        is_dirty = false; // We don't want to write back yet
-    } else if (as_dirty) {
-        new_entry |= (1ULL << 32);
+// Returns whether the first level holds the stored word afterwards
+bool store_to_cache(Cache *cache, uint32_t address, uint32_t operand) {
+    uint8_t slot;
+    cache->evicted_count = 0;
+    if (cache->trace) {
+        record_trace(cache->trace, address, true);
+    }
+    if (!cache->write_allocate && !lookup_line(cache, address, &slot)) {
+        record_access(cache, address & ~(uint32_t)(cache->line_words - 1), false);
+        observe_access(cache, address);
+        write_below(cache, address, operand);
+        return false;
     }
+    if (cache->write_policy == WRITE_BACK) {
+        add_to_cache(cache, address, operand, true);
+        return true;
+    }
+    // Write-through keeps the cached word clean, the store goes on to RAM right away
+    access_line(cache, address);
+    set_word(cache, cache->last_word, operand, false);
+    write_below(cache, address, operand);
+    return true;
+}
 
-    cache->entries[index] = new_entry;
-    *is_valid_result = is_dirty;
-    return is_dirty ? ((uint64_t)stored_address << 32) | stored_operand : 0;
+void flush_cache(Cache *cache, Queue64 *writebacks) {
+    // The last level goes first, the dirty words of the first level are the newest
+    Cache *level = cache;
+    while (level->next_level) level = level->next_level;
+    for (; level; level = level->upper_level) {
+        for (uint64_t valid = level->valid_mask; valid; valid &= valid - 1) {
+            uint8_t slot = __builtin_ctzll(valid); // Empty slots have nothing to write back
+            for (uint8_t dirty = level->dirty_masks[slot]; dirty; dirty &= dirty - 1) {
+                uint16_t index = ((uint16_t)slot << level->line_bits) | __builtin_ctz(dirty);
+                cache->evicted_count = 0;
+                write_ram_word(level, ((uint64_t)get_word_address(level, index) << 32) | level->operands[index]);
+                for (uint8_t i = 0; i < cache->evicted_count; i++) {
+                    enqueue_with_bit(writebacks, cache->evicted[i], true);
+                }
+            }
+            level->dirty_masks[slot] = 0;
+        }
+    }
+    while (cache->write_buffer_count > 0) {
+        cache->evicted_count = 0;
+        drain_write_buffer(cache);
+        enqueue_with_bit(writebacks, cache->evicted[0], true);
+    }
+    cache->evicted_count = 0;
 }
 
 void writeback_cache_entry(Cache *cache, uint8_t *ram, uint64_t cache_entry, uint8_t instruction_size) {
@@ -119,46 +1305,130 @@ void writeback_cache_entry(Cache *cache, uint8_t *ram, uint64_t cache_entry, uin
 }
 
 uint32_t get_u32_from_cache_or_ram(Cache *cache, uint8_t *ram, uint32_t address, uint8_t instruction_size) {
-    uint64_t cache_result = find_in_cache(cache, address);
-    if (cache_result == UINT32_MAX + 1) {
-        uint8_t opcode = (uint8_t)ram[address * instruction_size];
-        if (opcode != 0) {
-            fprintf(stderr, "\nTried to load non-data address at %u.\n", address);
-            free_cache(cache);
-            free(ram);
-            exit(EXIT_FAILURE);
-        }
-        uint32_t operant = (uint32_t)ram[(address * instruction_size) + 1];
-        // if address 0 writes back 0 we have a lot of trouble
-        bool is_valid_result = false;
-        cache_result = add_to_cache(cache, address, operant, false, &is_valid_result);
-        if (is_valid_result) {
-            writeback_cache_entry(cache, ram, cache_result, instruction_size);
-        }
-        return operant;
-    } else {
-        return (uint32_t)cache_result;
+    // Checked on hits too, a line fill brings the instruction cells next to the data into the cache as well
+    uint8_t opcode = (uint8_t)ram[(uint64_t)address * instruction_size];
+    if (opcode != 0) {
+        fprintf(stderr, "\nTried to load non-data address at %u.\n", address);
+        free_cache(cache);
+        free_ram(ram);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t slot;
+    bool is_cached = lookup_line(cache, address, &slot);
+    // A miss loads the whole line through the hierarchy, dirty victim words are written back on the way
+    cache->evicted_count = 0;
+    if (cache->trace) {
+        record_trace(cache->trace, address, false);
+    }
+    if (cache->prefetcher) {
+        cache->prefetcher->tick++;
+        if (!is_cached && cache->prefetcher->kind == PREFETCH_STREAM) take_from_stream_buffer(cache, address);
     }
+    bool is_hit = access_line(cache, address);
+    uint32_t operand = cache->operands[cache->last_word];
+    if (cache->prefetcher) {
+        run_prefetcher(cache, address, is_hit);
+    }
+    cache->access_index++;
+    return operand;
+}
+
+bool read_cache_word(const Cache *cache, uint16_t index, uint32_t *address, uint32_t *operand, bool *is_dirty) {
+    *address = get_word_address(cache, index);
+    *operand = cache->operands[index];
+    *is_dirty = is_word_dirty(cache, index);
+    return is_slot_valid(cache, index >> cache->line_bits);
 }
 
 void print_cache(Cache *cache) {
-    if (!cache || !cache->entries) {
+    if (!cache || !cache->operands) {
         printf("Cache is not initialized.\n");
         return;
     }
-    printf("Cache Contents:\n{");
-    for (uint8_t i = 0; i < cache->size; i++) {
-        uint64_t entry = cache->entries[i];
-
-        bool is_dirty = entry & (1ULL << 32);
-        uint32_t stored_address = (uint32_t)(entry >> 32 + cache->cache_bits) << cache->cache_bits; // Extract the address
-        int32_t operand = (int32_t)(entry & 0xFFFFFFFF); // Extract the operand
-        printf("%d/%s: (%u, %d), ", i, is_dirty ? "1" : "0", stored_address | i, operand);
-        if (i % 2 == 1) {
+    bool is_set_associative = cache->ways > 1 && !cache->fully_associative;
+    // A row holds a whole set, a single line or two single-word entries
+    uint16_t row_words = is_set_associative ? cache->ways * cache->line_words : (cache->line_words > 1 ? cache->line_words : 2);
+    const char *level = cache->upper_level ? "L2 " : "";
+    if (cache->fully_associative) {
+        printf("%sCache Contents (fully associative, %u words per line, %s):\n{", level, cache->line_words, REPLACEMENT_POLICIES[cache->policy]);
+    } else {
+        printf("%sCache Contents (%u sets, %u ways, %u words per line, %s):\n{", level, 1 << cache->set_bits, cache->ways, cache->line_words, REPLACEMENT_POLICIES[cache->policy]);
+    }
+    for (uint16_t i = 0; i < get_word_count(cache); i++) {
+        uint8_t slot = i >> cache->line_bits;
+        uint32_t stored_address, stored_operand;
+        bool is_dirty;
+        read_cache_word(cache, i, &stored_address, &stored_operand, &is_dirty);
+        if (is_set_associative) {
+            printf("%d.%d/%s: (%u, %d), ", slot >> cache->way_bits, slot & (cache->ways - 1), is_dirty ? "1" : "0", stored_address, (int32_t)stored_operand);
+        } else {
+            printf("%d/%s: (%u, %d), ", slot, is_dirty ? "1" : "0", stored_address, (int32_t)stored_operand);
+        }
+        if (i % row_words == row_words - 1) {
             printf("\n");
         }
     }
     printf("}\n");
+    if (cache->next_level) {
+        print_cache(cache->next_level);
+    }
+}
+
+void print_cache_counters(const char *name, const CacheCounters *counters) {
+    uint64_t accesses = counters->hits + counters->misses;
+    char coherence[40] = "";
+    if (counters->coherence_misses) {
+        snprintf(coherence, sizeof(coherence), ", %" PRIu64 " coherence", counters->coherence_misses);
+    }
+    printf("%-8s: %" PRIu64 " hits, %" PRIu64 " misses (%" PRIu64 " compulsory, %" PRIu64 " capacity, %" PRIu64 " conflict%s), %.2f%% hit rate, %" PRIu64 " dirty evictions, %" PRIu64 " write-backs\n",
+           name, counters->hits, counters->misses, counters->compulsory_misses, counters->capacity_misses, counters->conflict_misses, coherence,
+           accesses ? 100.0 * counters->hits / accesses : 0.0, counters->dirty_evictions, counters->writebacks);
+}
+
+void print_cache_stats(const Cache *cache) {
+    char name[8];
+    for (uint8_t level = 1; cache; cache = cache->next_level, level++) {
+        snprintf(name, sizeof(name), "L%u", level);
+        print_cache_counters(name, &cache->counters);
+        if (cache->next_level) {
+            printf("%-8s  %s L2\n", "", cache->exclusive ? "exclusive" : "inclusive");
+        }
+        if (!cache->upper_level) {
+            for (uint8_t op_code = 0; op_code < OPCODE_COUNT; op_code++) {
+                const CacheCounters *counters = &cache->opcode_counters[op_code];
+                if (counters->hits + counters->misses + counters->dirty_evictions > 0) {
+                    print_cache_counters(INSTRUCTION_SET[op_code] ? INSTRUCTION_SET[op_code] : "UNKNOWN", counters);
+                }
+            }
+        }
+        if (!cache->upper_level && cache->fetch_counters.hits + cache->fetch_counters.misses > 0) {
+            print_cache_counters("FETCH", &cache->fetch_counters);
+        }
+        if (!cache->upper_level) {
+            printf("RAM: %" PRIu64 " word writes, %" PRIu64 " coalesced in the write buffer (%s, %s)\n", cache->ram_writes, cache->coalesced_writes,
+                   cache->write_policy == WRITE_BACK ? "write-back" : "write-through", cache->write_allocate ? "write-allocate" : "no-write-allocate");
+        }
+        if (cache->prefetcher) {
+            const Prefetcher *prefetcher = cache->prefetcher;
+            uint64_t covered = prefetcher->useful + cache->counters.misses;
+            printf("Prefetcher (%s): %" PRIu64 " issued, %.2f%% accuracy, %.2f%% coverage, %" PRIu64 " late, %" PRIu64 " polluting\n",
+                   PREFETCHERS[prefetcher->kind], prefetcher->issued, prefetcher->issued ? 100.0 * prefetcher->useful / prefetcher->issued : 0.0,
+                   covered ? 100.0 * prefetcher->useful / covered : 0.0, prefetcher->late, prefetcher->polluting);
+        }
+        for (uint8_t i = 0; i < cache->shadow_cache_count; i++) {
+            const Cache *shadow = cache->shadow_caches[i];
+            char shadow_name[32];
+            snprintf(shadow_name, sizeof(shadow_name), "Shadow %u:%u:%s:%u", shadow->cache_bits, shadow->fully_associative ? 0 : shadow->ways,
+                     REPLACEMENT_POLICIES[shadow->policy], shadow->line_words);
+            print_cache_counters(shadow_name, &shadow->counters);
+        }
+    }
+}
+
+void print_icache_stats(const Cache *icache) {
+    print_cache_counters("I-cache", &icache->counters);
+    printf("%-8s  %u entries, %u ways, %s, %u words per line\n", "", icache->size, icache->fully_associative ? icache->size : icache->ways,
+           REPLACEMENT_POLICIES[icache->policy], icache->line_words);
 }
 
 Cache *duplicate_cache(const Cache *original) {
@@ -172,21 +1442,574 @@ Cache *duplicate_cache(const Cache *original) {
     }
 
     // Copy primitive fields
-    copy->size = original->size;
-    copy->cache_bits = original->cache_bits;
+    *copy = *original;
+
+    // Allocate memory for the entries and replacement state
+    size_t set_count = (size_t)1 << copy->set_bits;
+    copy->operands = malloc(get_word_count(copy) * sizeof(uint32_t));
+    copy->dirty_masks = malloc(copy->size * sizeof(uint8_t));
+    copy->ages = malloc(copy->size * sizeof(uint8_t));
+    copy->set_states = malloc(set_count * sizeof(uint64_t));
+    copy->tags = malloc(copy->size * sizeof(uint32_t));
+    if (!copy->operands || !copy->dirty_masks || !copy->ages || !copy->set_states || !copy->tags) {
+        perror("Failed to allocate memory for cache entries");
+        free(copy->operands);
+        free(copy->dirty_masks);
+        free(copy->ages);
+        free(copy->set_states);
+        free(copy->tags);
+        free(copy); // Free the structure itself before returning
+        return NULL;
+    }
+
+    // Copy the arrays
+    memcpy(copy->operands, original->operands, get_word_count(copy) * sizeof(uint32_t));
+    memcpy(copy->dirty_masks, original->dirty_masks, copy->size * sizeof(uint8_t));
+    memcpy(copy->ages, original->ages, copy->size * sizeof(uint8_t));
+    memcpy(copy->set_states, original->set_states, set_count * sizeof(uint64_t));
+    memcpy(copy->tags, original->tags, copy->size * sizeof(uint32_t));
+
+    // The write buffer, the prefetcher, the seen lines and the next level belong to this cache, so they are copied as well
+    copy->write_buffer = NULL;
+    copy->prefetcher = NULL;
+    copy->seen_lines = NULL;
+    copy->shadow_caches = NULL;
+    copy->shadow_cache_count = 0;
+    copy->trace = NULL; // Only the running cache records and analyzes
+    copy->bus = NULL;
+    copy->invalidated_lines = NULL;
+    copy->reuse = NULL;
+    copy->next_level = NULL;
+    copy->upper_level = NULL;
+    size_t seen_lines_size = ((original->seen_lines_count + 63) >> 6) * sizeof(uint64_t);
+    if ((original->write_buffer && !(copy->write_buffer = malloc(original->write_buffer_size * sizeof(uint64_t))))
+        || (original->prefetcher && !(copy->prefetcher = malloc(sizeof(Prefetcher))))
+        || (original->seen_lines && !(copy->seen_lines = malloc(seen_lines_size)))) {
+        perror("Failed to allocate memory for cache copy");
+        free_cache(copy);
+        return NULL;
+    }
+    if (copy->write_buffer) memcpy(copy->write_buffer, original->write_buffer, original->write_buffer_size * sizeof(uint64_t));
+    if (copy->prefetcher) *copy->prefetcher = *original->prefetcher;
+    if (copy->seen_lines) memcpy(copy->seen_lines, original->seen_lines, seen_lines_size);
+    if (original->next_level) {
+        copy->next_level = duplicate_cache(original->next_level);
+        if (!copy->next_level) {
+            free_cache(copy);
+            return NULL;
+        }
+        copy->next_level->upper_level = copy;
+    }
+    if (original->shadow_cache_count > 0) {
+        copy->shadow_caches = malloc(original->shadow_cache_count * sizeof(Cache *));
+        if (!copy->shadow_caches) {
+            perror("Failed to allocate memory for cache copy");
+            free_cache(copy);
+            return NULL;
+        }
+        for (; copy->shadow_cache_count < original->shadow_cache_count; copy->shadow_cache_count++) {
+            copy->shadow_caches[copy->shadow_cache_count] = duplicate_cache(original->shadow_caches[copy->shadow_cache_count]);
+            if (!copy->shadow_caches[copy->shadow_cache_count]) {
+                free_cache(copy);
+                return NULL;
+            }
+        }
+    }
+
+    return copy;
+}
+
+// *** Address trace ***
+
+TraceWriter *open_trace(const char *path) {
+    TraceWriter *trace = malloc(sizeof(TraceWriter));
+    if (!trace) {
+        perror("Failed to allocate memory for the trace");
+        exit(EXIT_FAILURE);
+    }
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        fprintf(stderr, "Failed to open trace file %s: %s\n", path, strerror(errno));
+        free(trace);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t version = TRACE_VERSION;
+    fwrite(TRACE_MAGIC, 1, 4, trace->file);
+    fwrite(&version, 1, 1, trace->file);
+    trace->last_address = 0;
+    trace->records = 0;
+    return trace;
+}
+
+void record_trace(TraceWriter *trace, uint32_t address, bool is_write) {
+    int64_t delta = (int64_t)address - trace->last_address;
+    uint64_t value = ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 1) | is_write; // Small strides in either direction stay short
+    uint8_t bytes[10];
+    uint8_t length = 0;
+    do {
+        bytes[length++] = (uint8_t)(value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+    fwrite(bytes, 1, length, trace->file);
+    trace->last_address = address;
+    trace->records++;
+}
+
+void close_trace(TraceWriter *trace) {
+    if (trace) {
+        fclose(trace->file);
+        free(trace);
+    }
+}
+
+// Decodes a whole trace, returns the number of accesses
+uint64_t read_trace(const char *path, uint32_t **addresses, uint8_t **is_write) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open trace file %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char magic[4];
+    uint8_t version;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0 || fread(&version, 1, 1, file) != 1 || version != TRACE_VERSION) {
+        fprintf(stderr, "%s is not a version %u trace file.\n", path, TRACE_VERSION);
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t capacity = 1024, count = 0, value = 0;
+    uint8_t shift = 0;
+    uint32_t address = 0;
+    int c = EOF;
+    *addresses = malloc(capacity * sizeof(uint32_t));
+    *is_write = malloc(capacity * sizeof(uint8_t));
+    while (*addresses && *is_write && (c = fgetc(file)) != EOF) {
+        value |= (uint64_t)(c & 0x7F) << shift;
+        shift += 7;
+        if (c & 0x80) {
+            if (shift < 64) continue;
+            break; // Longer than any varint we write
+        }
+        if (count == capacity) {
+            capacity <<= 1;
+            uint32_t *grown_addresses = realloc(*addresses, capacity * sizeof(uint32_t));
+            uint8_t *grown_writes = grown_addresses ? realloc(*is_write, capacity * sizeof(uint8_t)) : NULL;
+            if (grown_addresses) *addresses = grown_addresses;
+            if (grown_writes) *is_write = grown_writes;
+            if (!grown_addresses || !grown_writes) break;
+        }
+        uint64_t zigzag = value >> 1;
+        address += (uint32_t)(int64_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+        (*addresses)[count] = address;
+        (*is_write)[count++] = value & 1;
+        value = 0;
+        shift = 0;
+    }
+    if (!*addresses || !*is_write || c != EOF || shift != 0) {
+        fprintf(stderr, "Failed to decode trace file %s after %" PRIu64 " accesses.\n", path, count);
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    return count;
+}
+
+// *** Timing ***
+
+static const uint32_t DEFAULT_CLASS_CYCLES[TIMING_CLASS_COUNT] = {
+    [TIMING_OTHER]=1, [TIMING_IMMEDIATE]=1, [TIMING_LOAD]=1, [TIMING_STORE]=1, 
+    [TIMING_ALU]=1, [TIMING_MUL]=4, [TIMING_DIV]=20, [TIMING_JUMP]=2
+};
+
+static uint32_t *get_timing_latency(TimingModel *timing, const char *key) {
+    for (uint8_t class = 0; class < TIMING_CLASS_COUNT; class++) {
+        if (strcmp(key, TIMING_CLASSES[class]) == 0) return &timing->class_cycles[class];
+    }
+    if (strcmp(key, "hit") == 0) return &timing->hit_cycles;
+    if (strcmp(key, "l2-hit") == 0) return &timing->l2_hit_cycles;
+    if (strcmp(key, "miss") == 0) return &timing->miss_cycles;
+    if (strcmp(key, "write-back") == 0) return &timing->writeback_cycles;
+    return NULL;
+}
+
+// Default latencies, overridden by the "key = cycles" lines of the timing file if there is one, # starts a comment
+void init_timing(TimingModel *timing, const char *path) {
+    memcpy(timing->class_cycles, DEFAULT_CLASS_CYCLES, sizeof(timing->class_cycles));
+    timing->hit_cycles = 1;
+    timing->l2_hit_cycles = 10;
+    timing->miss_cycles = 100;
+    timing->writeback_cycles = 20;
+    reset_timing(timing);
+    if (!path || path[0] == '\0') {
+        return;
+    }
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open timing file %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    char line[128];
+    char key[32];
+    char value[32];
+    char rest;
+    for (uint32_t line_number = 1; fgets(line, sizeof(line), file); line_number++) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0') continue;
+        uint32_t *latency = NULL;
+        unsigned long long cycles = 0;
+        // Digits only, %u and strtoul would take a sign and wrap -1 around to UINT32_MAX
+        if (sscanf(line, " %31[^= \t] = %31s %c", key, value, &rest) == 2 && value[strspn(value, "0123456789")] == '\0') {
+            errno = 0;
+            cycles = strtoull(value, NULL, 10);
+            latency = errno == 0 && cycles <= UINT32_MAX ? get_timing_latency(timing, key) : NULL;
+        }
+        if (!latency) {
+            fprintf(stderr, "Invalid line %u in timing file %s, expected one of the instruction classes or hit, l2-hit, miss, write-back = cycles (0-%u).\n",
+                    line_number, path, UINT32_MAX);
+            fclose(file);
+            exit(EXIT_FAILURE);
+        }
+        *latency = (uint32_t)cycles;
+    }
+    fclose(file);
+}
+
+void reset_timing(TimingModel *timing) {
+    timing->instructions = 0;
+    timing->instruction_cycles = 0;
+    timing->data_loads = 0;
+    timing->data_stores = 0;
+    timing->memory_cycles = 0;
+    timing->fetch_misses = 0;
+}
+
+void time_instruction(TimingModel *timing, uint8_t op_code) {
+    timing->instructions++;
+    timing->instruction_cycles += timing->class_cycles[OPCODE_TIMING_CLASSES[op_code]];
+    switch (op_code) {
+        case LDA_IND:
+            timing->data_loads += 2;
+            break;
+        case STA_IND:
+            timing->data_loads++;
+            // Fallthrough
+        case STA_DIR:
+            timing->data_stores++;
+            break;
+        case LDA_DIR: case ADD_DIR: case SUB_DIR: case MUL_DIR: case DIV_DIR:
+        case JMP_IND: case JNZ_IND: case JZE_IND: case JLE_IND:
+            timing->data_loads++;
+            break;
+        default:
+            break;
+    }
+}
+
+// Without a cache every load goes to RAM and every store is a RAM write
+static uint64_t get_memory_cycles(const TimingModel *timing, const Cache *cache) {
+    if (!cache) {
+        return timing->data_loads * timing->miss_cycles + timing->data_stores * timing->writeback_cycles;
+    }
+    const Cache *last = cache;
+    const CacheCounters *fetches = &cache->fetch_counters; // A hit fetch is part of the instruction, like with a split I-cache
+    uint64_t cycles = (cache->counters.hits + cache->counters.misses - fetches->hits - fetches->misses) * timing->hit_cycles;
+    for (const Cache *level = cache->next_level; level; level = level->next_level) {
+        cycles += (level->counters.hits + level->counters.misses) * timing->l2_hit_cycles;
+        last = level;
+    }
+    return cycles + last->counters.misses * timing->miss_cycles + cache->ram_writes * timing->writeback_cycles;
+}
+
+// The counters of a cache that is about to be replaced, they would be lost with it
+void retire_cache_timing(TimingModel *timing, const Cache *cache) {
+    timing->memory_cycles += get_memory_cycles(timing, cache);
+}
+
+// Pass NULL as the cache when the data cells bypassed it
+uint64_t get_cycles(const TimingModel *timing, const Cache *cache) {
+    return timing->instruction_cycles + timing->memory_cycles + timing->fetch_misses * timing->miss_cycles + get_memory_cycles(timing, cache);
+}
+
+void print_timing(const TimingModel *timing, const Cache *cache) {
+    uint64_t cycles = get_cycles(timing, cache);
+    printf("%-8s: %" PRIu64 " cycles for %" PRIu64 " instructions, %.2f CPI (%" PRIu64 " execute, %" PRIu64 " memory)\n", "Timing",
+           cycles, timing->instructions, timing->instructions ? (double)cycles / timing->instructions : 0.0,
+           timing->instruction_cycles, cycles - timing->instruction_cycles);
+}
+
+// *** Branch prediction ***
+
+BranchPredictor *create_branch_predictor(uint8_t kind, uint8_t history_bits) {
+    if (kind > MAX_PREDICTOR || (kind == PREDICT_GSHARE && (history_bits == 0 || history_bits > MAX_HISTORY_BITS))) {
+        fprintf(stderr, "The history bits %u are not in range (1:%u).\n", history_bits, MAX_HISTORY_BITS);
+        exit(EXIT_FAILURE);
+    }
+    BranchPredictor *predictor = malloc(sizeof(BranchPredictor));
+    if (!predictor) {
+        perror("Failed to allocate memory for the branch predictor");
+        exit(EXIT_FAILURE);
+    }
+    predictor->kind = kind;
+    predictor->history_bits = history_bits;
+    predictor->site_capacity = 64;
+    predictor->sites = malloc(predictor->site_capacity * sizeof(BranchSite));
+    if (!predictor->sites) {
+        perror("Failed to allocate memory for the branch sites");
+        exit(EXIT_FAILURE);
+    }
+    reset_branch_predictor(predictor);
+    return predictor;
+}
+
+// Forgets the learned outcomes together with the statistics
+void reset_branch_predictor(BranchPredictor *predictor) {
+    predictor->history = 0;
+    memset(predictor->counters, 1, sizeof(predictor->counters)); // Weakly not taken
+    memset(predictor->btb_pcs, 0xFF, sizeof(predictor->btb_pcs));
+    memset(predictor->sites, 0xFF, predictor->site_capacity * sizeof(BranchSite));
+    predictor->site_count = 0;
+    predictor->conditional = 0;
+    predictor->conditional_correct = 0;
+    predictor->indirect = 0;
+    predictor->btb_hits = 0;
+}
+
+void free_branch_predictor(BranchPredictor *predictor) {
+    if (predictor) {
+        free(predictor->sites);
+        free(predictor);
+    }
+}
+
+// JMP_DIR needs no prediction, its target is in the instruction
+bool is_predicted_jump(uint8_t op_code) {
+    return OPCODE_TIMING_CLASSES[op_code] == TIMING_JUMP && op_code != JMP_DIR;
+}
+
+static inline bool is_indirect_jump(uint8_t op_code) {
+    return op_code == JMP_IND || op_code == JNZ_IND || op_code == JZE_IND || op_code == JLE_IND;
+}
+
+static BranchSite *get_branch_site(BranchPredictor *predictor, uint32_t pc) {
+    if (predictor->site_count * 2 >= predictor->site_capacity) {
+        BranchSite *old_sites = predictor->sites;
+        uint32_t old_capacity = predictor->site_capacity;
+        predictor->site_capacity <<= 1;
+        predictor->sites = malloc(predictor->site_capacity * sizeof(BranchSite));
+        if (!predictor->sites) {
+            perror("Failed to grow the branch sites");
+            exit(EXIT_FAILURE);
+        }
+        memset(predictor->sites, 0xFF, predictor->site_capacity * sizeof(BranchSite));
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (old_sites[i].pc == UINT32_MAX) continue;
+            uint32_t slot = (old_sites[i].pc * 2654435761u) & (predictor->site_capacity - 1);
+            while (predictor->sites[slot].pc != UINT32_MAX) slot = (slot + 1) & (predictor->site_capacity - 1);
+            predictor->sites[slot] = old_sites[i];
+        }
+        free(old_sites);
+    }
+    uint32_t slot = (pc * 2654435761u) & (predictor->site_capacity - 1);
+    while (predictor->sites[slot].pc != pc && predictor->sites[slot].pc != UINT32_MAX) {
+        slot = (slot + 1) & (predictor->site_capacity - 1);
+    }
+    BranchSite *site = &predictor->sites[slot];
+    if (site->pc == UINT32_MAX) {
+        memset(site, 0, sizeof(BranchSite));
+        site->pc = pc;
+        predictor->site_count++;
+    }
+    return site;
+}
+
+static inline uint32_t get_counter_index(const BranchPredictor *predictor, uint32_t pc) {
+    uint32_t index = pc;
+    if (predictor->kind == PREDICT_GSHARE) {
+        index ^= predictor->history & ((1u << predictor->history_bits) - 1);
+    }
+    return index & ((1u << PREDICTOR_TABLE_BITS) - 1);
+}
+
+// Trains the predictor with the executed jump at pc, returns whether the front end fetched next_pc right after it
+bool predict_branch(BranchPredictor *predictor, uint32_t pc, uint8_t op_code, uint32_t next_pc) {
+    bool is_taken = next_pc != pc + 1;
+    bool is_predicted_taken = true; // JMP_IND
+    bool is_correct;
+    if (op_code != JMP_IND) {
+        uint8_t *counter = &predictor->counters[get_counter_index(predictor, pc)];
+        switch (predictor->kind) {
+            case PREDICT_NOT_TAKEN:
+                is_predicted_taken = false;
+                break;
+            case PREDICT_TAKEN:
+                is_predicted_taken = true;
+                break;
+            default:
+                is_predicted_taken = *counter >= 2;
+                if (is_taken && *counter < 3) (*counter)++;
+                if (!is_taken && *counter > 0) (*counter)--;
+                break;
+        }
+        predictor->history = (predictor->history << 1) | is_taken;
+        predictor->conditional++;
+        predictor->conditional_correct += is_predicted_taken == is_taken;
+    }
+    is_correct = is_predicted_taken == is_taken;
+    if (is_taken && is_indirect_jump(op_code)) {
+        uint8_t entry = pc & (BTB_SIZE - 1);
+        bool is_hit = predictor->btb_pcs[entry] == pc && predictor->btb_targets[entry] == next_pc;
+        predictor->indirect++;
+        predictor->btb_hits += is_hit;
+        is_correct = is_correct && is_hit;
+        predictor->btb_pcs[entry] = pc;
+        predictor->btb_targets[entry] = next_pc;
+    }
+    BranchSite *site = get_branch_site(predictor, pc);
+    site->op_code = op_code;
+    site->executed++;
+    site->taken += is_taken;
+    site->correct += is_correct;
+    return is_correct;
+}
+
+static int compare_mispredictions(const void *a, const void *b) {
+    const BranchSite *x = a, *y = b;
+    uint64_t x_wrong = x->executed - x->correct, y_wrong = y->executed - y->correct;
+    if (x_wrong != y_wrong) return x_wrong < y_wrong ? 1 : -1;
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+void print_branch_stats(const BranchPredictor *predictor) {
+    char history[24] = "";
+    if (predictor->kind == PREDICT_GSHARE) {
+        snprintf(history, sizeof(history), ", %u history bits", predictor->history_bits);
+    }
+    printf("%-8s: %" PRIu64 " conditional, %.2f%% predicted (%s%s), %" PRIu64 " taken indirect, %.2f%% BTB hits (%u entries)\n", "Branches",
+           predictor->conditional, predictor->conditional ? 100.0 * predictor->conditional_correct / predictor->conditional : 0.0,
+           PREDICTORS[predictor->kind], history, predictor->indirect, predictor->indirect ? 100.0 * predictor->btb_hits / predictor->indirect : 0.0, BTB_SIZE);
+    BranchSite *sites = malloc((predictor->site_count ? predictor->site_count : 1) * sizeof(BranchSite));
+    if (!sites) {
+        perror("Failed to allocate memory for the branch report");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < predictor->site_capacity; i++) {
+        if (predictor->sites[i].pc != UINT32_MAX) sites[count++] = predictor->sites[i];
+    }
+    qsort(sites, count, sizeof(BranchSite), compare_mispredictions);
+    for (uint32_t i = 0; i < count && i < BRANCH_REPORT_SITES; i++) {
+        const BranchSite *site = &sites[i];
+        printf("  [%u] %-7s: %" PRIu64 " executed, %.2f%% taken, %.2f%% predicted, %" PRIu64 " mispredicted\n", site->pc, INSTRUCTION_SET[site->op_code],
+               site->executed, 100.0 * site->taken / site->executed, 100.0 * site->correct / site->executed, site->executed - site->correct);
+    }
+    if (count > BRANCH_REPORT_SITES) {
+        printf("  ... %u more jumps\n", count - BRANCH_REPORT_SITES);
+    }
+    free(sites);
+}
+
+// *** Pipeline ***
+
+// Also resets the branch predictor, the front end starts over with the program
+void reset_pipeline(Pipeline *pipeline) {
+    BranchPredictor *predictor = pipeline->predictor;
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->predictor = predictor;
+    if (predictor) {
+        reset_branch_predictor(predictor);
+    }
+    for (uint8_t stage = 0; stage < PIPELINE_STAGES; stage++) {
+        pipeline->stage_pcs[stage] = PIPELINE_BUBBLE;
+    }
+}
+
+static inline bool reads_acc_in_execute(uint8_t op_code) {
+    switch (op_code) {
+        case STA_DIR: case STA_IND: case ADD_DIR: case SUB_DIR: case MUL_DIR: case DIV_DIR:
+        case JNZ_DIR: case JNZ_IND: case JZE_DIR: case JZE_IND: case JLE_DIR: case JLE_IND:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The loaded operand is only there at the end of MEM, so is the result computed from it
+static inline bool writes_acc_after_memory(uint8_t op_code) {
+    return op_code == LDA_DIR || op_code == LDA_IND || op_code == ADD_DIR || op_code == SUB_DIR || op_code == MUL_DIR || op_code == DIV_DIR;
+}
+
+// Wrong-path instructions fetched until the jump resolves: JMP_DIR in ID, the conditional ones in EX, indirect targets after MEM
+static inline uint8_t get_resolve_penalty(uint8_t op_code) {
+    switch (op_code) {
+        case JMP_DIR:
+            return 1;
+        case JNZ_DIR: case JZE_DIR: case JLE_DIR:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+static void shift_stages(Pipeline *pipeline, uint32_t pc) {
+    memmove(pipeline->stage_pcs + 1, pipeline->stage_pcs, (PIPELINE_STAGES - 1) * sizeof(uint32_t));
+    pipeline->stage_pcs[0] = pc;
+}
+
+// Called after the interpreter executed the instruction at pc, with the timing model already charged for it
+void pipeline_instruction(Pipeline *pipeline, const TimingModel *timing, const Cache *cache, uint32_t pc, uint8_t op_code, uint32_t next_pc) {
+    uint64_t memory_cycles = get_cycles(timing, cache) - timing->instruction_cycles;
+    uint64_t data_accesses = timing->data_loads + timing->data_stores;
+    uint64_t hit_cycles = (data_accesses - pipeline->last_data_accesses) * timing->hit_cycles;
+    uint64_t memory_stalls = memory_cycles - pipeline->last_memory_cycles;
+    memory_stalls = memory_stalls > hit_cycles ? memory_stalls - hit_cycles : 0; // A hit fits into MEM
+    uint8_t class = OPCODE_TIMING_CLASSES[op_code];
+    uint32_t execute_cycles = class == TIMING_JUMP ? 1 : timing->class_cycles[class]; // Jumps pay for the flush below instead
+    uint64_t stalls = memory_stalls + (execute_cycles > 1 ? execute_cycles - 1 : 0);
+    pipeline->memory_stalls += memory_stalls;
+    pipeline->execute_stalls += execute_cycles > 1 ? execute_cycles - 1 : 0;
+    pipeline->last_memory_cycles = memory_cycles;
+    pipeline->last_data_accesses = data_accesses;
+
+    if (pipeline->is_acc_late && reads_acc_in_execute(op_code)) {
+        pipeline->load_use_stalls++; // Forwarded from MEM/WB one cycle later
+        stalls++;
+    }
+    pipeline->is_acc_late = writes_acc_after_memory(op_code);
+    uint8_t penalty = 0;
+    bool is_taken = next_pc != pc + 1;
+    if (pipeline->predictor && is_predicted_jump(op_code)) {
+        if (!predict_branch(pipeline->predictor, pc, op_code, next_pc)) {
+            penalty = get_resolve_penalty(op_code);
+        } else if (is_taken && !is_indirect_jump(op_code)) {
+            penalty = 1; // Predicted, but the target is only known once the jump is decoded
+        }
+    } else if (is_taken) {
+        penalty = get_resolve_penalty(op_code);
+    }
+    pipeline->control_stalls += penalty;
+    stalls += penalty;
+    pipeline->instructions++;
 
-    // Allocate memory for the entries array
-    copy->entries = malloc(copy->size * sizeof(uint64_t));
-    if (!copy->entries) {
-        perror("Failed to allocate memory for cache entries");
-        free(copy); // Free the structure itself before returning
-        return NULL;
+    // Only the last cycles are visible, a long miss leaves nothing but bubbles behind
+    for (uint64_t i = 0; i < stalls && i < PIPELINE_STAGES; i++) {
+        shift_stages(pipeline, PIPELINE_BUBBLE);
     }
+    shift_stages(pipeline, pc);
+}
 
-    // Copy the entries array
-    memcpy(copy->entries, original->entries, copy->size * sizeof(uint64_t));
+// One cycle per instruction once the pipeline is full, plus filling it and every stall
+uint64_t get_pipeline_cycles(const Pipeline *pipeline) {
+    if (pipeline->instructions == 0) {
+        return 0;
+    }
+    return pipeline->instructions + PIPELINE_STAGES - 1 + pipeline->load_use_stalls + pipeline->control_stalls + pipeline->memory_stalls
+           + pipeline->execute_stalls;
+}
 
-    return copy;
+void print_pipeline(const Pipeline *pipeline) {
+    uint64_t cycles = get_pipeline_cycles(pipeline);
+    printf("%-8s: %" PRIu64 " cycles for %" PRIu64 " instructions, %.2f CPI, stalls: %" PRIu64 " load-use, %" PRIu64 " control, %" PRIu64
+           " memory, %" PRIu64 " execute\n", "Pipeline", cycles, pipeline->instructions, pipeline->instructions ? (double)cycles / pipeline->instructions : 0.0,
+           pipeline->load_use_stalls, pipeline->control_stalls, pipeline->memory_stalls, pipeline->execute_stalls);
 }
 
 // *************************************************
@@ -194,7 +2017,8 @@ Cache *duplicate_cache(const Cache *original) {
 // *************************************************
 void init_queue(Queue64 *queue, size_t size) {
     queue->data = malloc(size * sizeof(uint64_t));
-    if (!queue->data) {
+    queue->slots = malloc(size * sizeof(uint16_t));
+    if (!queue->data || !queue->slots) {
         perror("Failed to allocate memory for queue");
         exit(EXIT_FAILURE);
     }
@@ -234,7 +2058,9 @@ bool is_full(const Queue64 *queue) {
 
 void free_queue(Queue64 *queue) {
     free(queue->data);
+    free(queue->slots);
     queue->data = NULL;
+    queue->slots = NULL;
     queue->size = 0;
     queue->front = 0;
     queue->rear = 0;
@@ -252,6 +2078,10 @@ void reset_queue(Queue64 *queue) {
 }
 
 bool enqueue_with_bit(Queue64 *queue, uint64_t value, bool is_writeback) {
+    return enqueue_with_slot(queue, value, is_writeback, 0);
+}
+
+bool enqueue_with_slot(Queue64 *queue, uint64_t value, bool is_writeback, uint16_t slot) {
     if (queue->count == queue->size) {
         return false; // Queue is full
     }
@@ -264,12 +2094,18 @@ bool enqueue_with_bit(Queue64 *queue, uint64_t value, bool is_writeback) {
     }
 
     queue->data[queue->rear] = value;
+    queue->slots[queue->rear] = slot;
     queue->rear = (queue->rear + 1) % queue->size;
     queue->count++;
     return true;
 }
 
 bool dequeue_with_bit(Queue64 *queue, uint64_t *value, bool *is_writeback) {
+    uint16_t _;
+    return dequeue_with_slot(queue, value, is_writeback, &_);
+}
+
+bool dequeue_with_slot(Queue64 *queue, uint64_t *value, bool *is_writeback, uint16_t *slot) {
     if (queue->count == 0) {
         return false; // Queue is empty
     }
@@ -279,6 +2115,7 @@ bool dequeue_with_bit(Queue64 *queue, uint64_t *value, bool *is_writeback) {
     // Decode the extra bit
     *is_writeback = ~(encoded_value >> 63) & 1;
     *value = encoded_value & ~(1ULL << 63); // Clear MSB to extract the value
+    *slot = queue->slots[queue->front];
 
     queue->front = (queue->front + 1) % queue->size;
     queue->count--;
@@ -403,6 +2240,679 @@ int32_t sign_extend_i32(int32_t num, uint8_t operand_size) {
     return num;
 }
 
+// *** Mapped images ***
+
+// The cells of a .p file follow its header exactly like they lie in RAM, so the file itself can be the RAM.
+// The whole file is mapped privately behind the header: pages fault in on their first access, stores copy them.
+// RAM past the end of the file comes from an anonymous mapping reserved first, so it starts out zeroed as well.
+typedef struct {
+    uint8_t *base; // Start of the reservation, RAM starts header_size bytes later
+    size_t length;
+    int fd; // Kept open for snapshots of the image
+    uint8_t header_size;
+    uint64_t file_size; // Cells of the file, without the header
+} MappedImage;
+
+static MappedImage mapped_images[MAX_MAPPED_IMAGES];
+
+static MappedImage *find_mapped_image(const uint8_t *ram) {
+    for (uint8_t i = 0; ram && i < MAX_MAPPED_IMAGES; i++) {
+        if (mapped_images[i].base && mapped_images[i].base + mapped_images[i].header_size == ram) return &mapped_images[i];
+    }
+    return NULL;
+}
+
+// NULL when the image can't be mapped, the caller reads it into the heap instead
+static uint8_t *map_image(int fd, uint8_t header_size, uint64_t file_size, uint64_t ram_size) {
+#ifndef _WIN32
+    MappedImage *image = NULL;
+    for (uint8_t i = 0; !image && i < MAX_MAPPED_IMAGES; i++) {
+        if (!mapped_images[i].base) image = &mapped_images[i];
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    ram_size = max_u64(ram_size, file_size);
+    if (!image || page_size <= 0 || (uint64_t)header_size + ram_size > SIZE_MAX - (size_t)page_size) return NULL;
+    size_t length = ((size_t)header_size + ram_size + page_size - 1) / page_size * page_size;
+    size_t file_length = ((size_t)header_size + file_size + page_size - 1) / page_size * page_size; // The tail of the last page reads as 0
+    uint8_t *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return NULL;
+    int image_fd = dup(fd);
+    if (image_fd < 0 || mmap(base, file_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image_fd, 0) == MAP_FAILED) {
+        if (image_fd >= 0) close(image_fd);
+        munmap(base, length);
+        return NULL;
+    }
+    *image = (MappedImage){base, length, image_fd, header_size, file_size};
+    return base + header_size;
+#else
+    (void)fd; (void)header_size; (void)file_size; (void)ram_size;
+    return NULL;
+#endif
+}
+
+// Like realloc, but RAM past used_size is zeroed. Only for freshly loaded RAM: a mapped image that is big enough
+// is still zero past the file and stays as it is, without touching a single page.
+uint8_t *resize_ram(uint8_t *ram, uint64_t used_size, uint64_t new_size) {
+    MappedImage *image = find_mapped_image(ram);
+    if (image && image->header_size + new_size <= image->length) {
+        return ram;
+    }
+    uint8_t *resized = image ? malloc(new_size) : realloc(ram, new_size);
+    if (!resized) return NULL;
+    if (image) {
+        memcpy(resized, ram, used_size < new_size ? used_size : new_size);
+        free_ram(ram);
+    }
+    if (new_size > used_size) {
+        memset(resized + used_size, 0, new_size - used_size);
+    }
+    return resized;
+}
+
+// Snapshot of freshly loaded RAM, a mapped image is simply mapped a second time
+uint8_t *duplicate_ram(const uint8_t *ram, uint64_t size) {
+    const MappedImage *image = find_mapped_image(ram);
+    uint8_t *copy = image && image->header_size + size <= image->length ? map_image(image->fd, image->header_size, image->file_size, size) : NULL;
+    if (copy || !(copy = malloc(size))) return copy;
+    memcpy(copy, ram, size);
+    return copy;
+}
+
+void free_ram(uint8_t *ram) {
+    MappedImage *image = find_mapped_image(ram);
+    if (!image) {
+        free(ram);
+        return;
+    }
+#ifndef _WIN32
+    munmap(image->base, image->length);
+    close(image->fd);
+#endif
+    memset(image, 0, sizeof(MappedImage));
+}
+
+// *** Parallel decoding ***
+
+// Every cell has the same size, so the image splits at exact cell boundaries into slices decoded on their own threads.
+// A slice reads its cells (unless RAM holds them already), checks their opcodes and marks its data cells for seeding.
+typedef struct {
+    uint8_t *ram;
+    uint8_t instruction_size;
+    uint64_t first_cell; // A multiple of 64, so every slice owns whole words of the bitmap
+    uint64_t cell_count;
+    int fd; // Where the cells are read from, -1 when RAM already holds them
+    uint64_t file_offset; // Of the first cell of the image
+    uint64_t *data_cells; // Shared bitmap of the whole image
+    uint64_t unknown_opcodes;
+    uint64_t first_unknown; // Cell of the first unknown opcode of the slice
+    bool is_read_failed;
+} LoadSlice;
+
+static void *decode_slice(void *arg) {
+    LoadSlice *slice = arg;
+    uint8_t instruction_size = slice->instruction_size;
+    uint8_t *cells = slice->ram + slice->first_cell * instruction_size;
+#ifndef _WIN32
+    uint64_t size = slice->cell_count * instruction_size;
+    for (uint64_t done = 0; slice->fd >= 0 && done < size;) {
+        ssize_t bytes_read = pread(slice->fd, cells + done, size - done, (off_t)(slice->file_offset + slice->first_cell * instruction_size + done));
+        if (bytes_read <= 0) {
+            slice->is_read_failed = true;
+            return NULL;
+        }
+        done += (uint64_t)bytes_read;
+    }
+#endif
+    for (uint64_t cell = 0; cell < slice->cell_count; cell++) {
+        uint8_t op_code = cells[cell * instruction_size];
+        if (op_code == 0) {
+            uint64_t address = slice->first_cell + cell;
+            slice->data_cells[address >> 6] |= 1ULL << (address & 63);
+        } else if (op_code >= OPCODE_COUNT || !INSTRUCTION_SET[op_code]) {
+            if (slice->unknown_opcodes++ == 0) slice->first_unknown = slice->first_cell + cell;
+        }
+    }
+    return NULL;
+}
+
+// Slices merge in the order of their cells, the first unknown opcode of the earliest slice wins
+static void merge_slice(LoadSlice *total, const LoadSlice *slice) {
+    total->is_read_failed |= slice->is_read_failed;
+    if (slice->unknown_opcodes > 0 && total->unknown_opcodes == 0) total->first_unknown = slice->first_unknown;
+    total->unknown_opcodes += slice->unknown_opcodes;
+}
+
+static void warn_unknown_opcodes(const LoadSlice *total) {
+    if (total->unknown_opcodes > 0) {
+        fprintf(stderr, "Warning: %" PRIu64 " cells hold unknown opcodes, the first at %" PRIu64 ". Executing one stops the program.\n",
+                total->unknown_opcodes, total->first_unknown);
+    }
+}
+
+static uint64_t *create_data_cells(uint64_t cell_count) {
+    uint64_t *data_cells = calloc((cell_count + 63) >> 6 ? (cell_count + 63) >> 6 : 1, sizeof(uint64_t));
+    if (!data_cells) {
+        perror("Failed to allocate the data cell bitmap");
+        exit(EXIT_FAILURE);
+    }
+    return data_cells;
+}
+
+static uint8_t get_loader_threads(uint64_t cell_count) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long cpus = (long)info.dwNumberOfProcessors;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    uint64_t threads = cell_count / MIN_LOADER_SLICE_CELLS;
+    threads = threads < (uint64_t)(cpus > 0 ? cpus : 1) ? threads : (uint64_t)cpus;
+    return threads < 1 ? 1 : threads > MAX_LOADER_THREADS ? MAX_LOADER_THREADS : (uint8_t)threads;
+}
+
+// Returns the bitmap of the data cells, or NULL if reading the cells from fd failed. The slices merge in order,
+// so the result doesn't depend on the thread count.
+static uint64_t *decode_image(uint8_t *ram, uint64_t cell_count, uint8_t instruction_size, int fd, uint64_t file_offset) {
+    uint64_t *data_cells = create_data_cells(cell_count);
+    LoadSlice slices[MAX_LOADER_THREADS];
+    thread_t threads[MAX_LOADER_THREADS];
+    uint8_t thread_count = get_loader_threads(cell_count);
+    // Rounded up before aligning, so thread_count slices always cover the image
+    uint64_t slice_cells = ((cell_count + thread_count - 1) / thread_count + 63) & ~(uint64_t)63;
+    uint8_t slice_count = 0;
+    for (uint64_t first = 0; first < cell_count || slice_count == 0; first += slice_cells, slice_count++) {
+        slices[slice_count] = (LoadSlice){ram, instruction_size, first, cell_count - first < slice_cells ? cell_count - first : slice_cells,
+                                          fd, file_offset, data_cells, 0, 0, false};
+    }
+    // The loading thread takes the first slice itself, a small image never starts a thread
+    uint8_t started = 1;
+    for (; started < slice_count && thread_create(&threads[started], decode_slice, &slices[started]) == 0; started++);
+    decode_slice(&slices[0]);
+    for (uint8_t i = started; i < slice_count; i++) {
+        decode_slice(&slices[i]); // Couldn't start a thread for these
+    }
+    for (uint8_t i = 1; i < started; i++) {
+        thread_join(threads[i]);
+    }
+
+    LoadSlice total = {0};
+    for (uint8_t i = 0; i < slice_count; i++) {
+        merge_slice(&total, &slices[i]);
+    }
+    if (total.is_read_failed) {
+        free(data_cells);
+        return NULL;
+    }
+    warn_unknown_opcodes(&total);
+    if (slice_count > 1) {
+        printf("Decoded %" PRIu64 " cells in %u slices.\n", cell_count, slice_count);
+    }
+    return data_cells;
+}
+
+// *** Streaming ***
+
+// The buffers of the streaming loader are fixed windows of RAM itself, the cells already have their final layout.
+// One reader thread runs for the whole load and fills the next window while the loading thread decodes the one before,
+// so reading never waits for decoding. The two hand the STREAM_WINDOWS reads back and forth with a pair of semaphores.
+typedef struct {
+    FILE *file;
+    uint8_t *window;
+    size_t size;
+    size_t bytes_read;
+} WindowRead;
+
+typedef struct {
+    FILE *file;
+    WindowRead reads[STREAM_WINDOWS];
+    uint32_t queued_count;
+    uint32_t taken_count;
+    semaphore_t queued; // Posted for every read handed to the reader thread, a read without a window stops it
+    semaphore_t filled; // Posted for every finished read
+    thread_t thread;
+    bool is_threaded; // Otherwise every read happens right when it's queued
+} WindowReader;
+
+static void read_window(WindowRead *read) {
+    read->bytes_read = fread(read->window, 1, read->size, read->file);
+}
+
+static void *run_window_reader(void *arg) {
+    WindowReader *reader = arg;
+    for (uint32_t index = 0;; index++) {
+        semaphore_wait(&reader->queued);
+        WindowRead *read = &reader->reads[index % STREAM_WINDOWS];
+        if (!read->window) {
+            return NULL;
+        }
+        read_window(read);
+        semaphore_post(&reader->filled);
+    }
+}
+
+static void start_window_reader(WindowReader *reader, FILE *file) {
+    *reader = (WindowReader){.file = file};
+    if (semaphore_init(&reader->queued, 0) != 0) {
+        return;
+    } else if (semaphore_init(&reader->filled, 0) != 0) {
+        semaphore_destroy(&reader->queued);
+        return;
+    }
+    reader->is_threaded = thread_create(&reader->thread, run_window_reader, reader) == 0;
+    if (!reader->is_threaded) {
+        semaphore_destroy(&reader->queued);
+        semaphore_destroy(&reader->filled);
+    }
+}
+
+// At most STREAM_WINDOWS - 1 reads may be queued ahead of the one being decoded
+static void queue_window_read(WindowReader *reader, uint8_t *window, size_t size) {
+    WindowRead *read = &reader->reads[reader->queued_count++ % STREAM_WINDOWS];
+    *read = (WindowRead){reader->file, window, size, 0};
+    if (reader->is_threaded) {
+        semaphore_post(&reader->queued);
+    } else {
+        read_window(read);
+    }
+}
+
+// Waits for the oldest queued read
+static WindowRead *take_window_read(WindowReader *reader) {
+    if (reader->is_threaded) {
+        semaphore_wait(&reader->filled);
+    }
+    return &reader->reads[reader->taken_count++ % STREAM_WINDOWS];
+}
+
+// Reads that are still queued finish first, so no window is written to after this returns
+static void stop_window_reader(WindowReader *reader) {
+    if (!reader->is_threaded) {
+        return;
+    }
+    reader->reads[reader->queued_count % STREAM_WINDOWS] = (WindowRead){0};
+    semaphore_post(&reader->queued);
+    thread_join(reader->thread);
+    semaphore_destroy(&reader->queued);
+    semaphore_destroy(&reader->filled);
+}
+
+// Reads the cells following the header into RAM, returns the bitmap of the data cells or NULL on a short read
+static uint64_t *stream_image(FILE *p_file, uint8_t *ram, uint64_t cell_count, uint8_t instruction_size) {
+    uint64_t window_cells = STREAM_WINDOW_SIZE / instruction_size & ~(uint64_t)63; // Whole words of the bitmap
+    uint64_t *data_cells = create_data_cells(cell_count);
+    WindowReader reader;
+    start_window_reader(&reader, p_file);
+    LoadSlice total = {0};
+    if (cell_count > 0) {
+        queue_window_read(&reader, ram, (cell_count < window_cells ? cell_count : window_cells) * instruction_size);
+    }
+    for (uint64_t first = 0; first < cell_count; first += window_cells) {
+        WindowRead *read = take_window_read(&reader);
+        if (read->bytes_read != read->size) {
+            stop_window_reader(&reader);
+            free(data_cells);
+            return NULL;
+        }
+        uint64_t next = first + window_cells;
+        if (next < cell_count) {
+            queue_window_read(&reader, ram + next * instruction_size, (cell_count - next < window_cells ? cell_count - next : window_cells) * instruction_size);
+        }
+        LoadSlice slice = {ram, instruction_size, first, read->size / instruction_size, -1, 0, data_cells, 0, 0, false};
+        decode_slice(&slice);
+        merge_slice(&total, &slice);
+    }
+    stop_window_reader(&reader);
+    warn_unknown_opcodes(&total);
+    return data_cells;
+}
+
+// *** Packed images ***
+
+// A packed image is PACKED_MAGIC, a version byte, the operand and memory size of the plain header and the cell count,
+// followed by blocks of up to PACKED_BLOCK_CELLS cells. Each block first turns its cells into runs of equal opcodes,
+// every run is the opcode, the varint run length and the zigzag varints of the sign extended operands. That stream
+// is then compressed with a byte-oriented LZ codec, the checksum covers the original cells of the block. A block whose
+// runs don't get smaller than its cells, like one with a different opcode in every cell, keeps the plain cells instead.
+typedef struct {
+    uint32_t cell_count;
+    uint32_t transformed_size; // Of the run stream, 0 when the block holds the plain cells
+    uint32_t packed_size; // Equal to transformed_size when the run stream is stored as it is
+    uint32_t checksum; // FNV-1a of the cells, eight bytes at a time
+} PackedBlock;
+
+static uint32_t get_block_checksum(const uint8_t *cells, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, cells + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ cells[i]) * 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Opcode, run length of up to 3 bytes and an operand of up to 5 bytes per cell at most
+static size_t get_transformed_bound(uint32_t cell_count) {
+    return (size_t)cell_count * 7;
+}
+
+// A run of literals only grows by its length bytes
+static size_t get_lz_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+    size_t length = 0;
+    for (; value > 0x7F; value >>= 7) {
+        out[length++] = (uint8_t)(value & 0x7F) | 0x80;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+static bool get_varint(const uint8_t *in, size_t size, size_t *position, uint32_t *value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35 && *position < size; shift += 7) {
+        uint8_t byte = in[(*position)++];
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static size_t transform_cells(const uint8_t *cells, uint32_t cell_count, uint8_t operand_size, uint8_t *out) {
+    uint8_t instruction_size = 1 + operand_size;
+    size_t size = 0;
+    for (uint32_t cell = 0; cell < cell_count;) {
+        uint8_t op_code = cells[(uint64_t)cell * instruction_size];
+        uint32_t run = 1;
+        while (cell + run < cell_count && cells[(uint64_t)(cell + run) * instruction_size] == op_code) run++;
+        out[size++] = op_code;
+        size += put_varint(out + size, run);
+        for (uint32_t end = cell + run; cell < end; cell++) {
+            uint32_t temp_u32 = 0;
+            memcpy(&temp_u32, cells + (uint64_t)cell * instruction_size + 1, operand_size);
+            int32_t operand = sign_extend_i32(temp_u32, operand_size);
+            size += put_varint(out + size, ((uint32_t)operand << 1) ^ (uint32_t)(operand >> 31)); // Small negative data stays short
+        }
+    }
+    return size;
+}
+
+// Sets the bits of cells [first, first + count) in the data cell bitmap
+static void mark_data_cells(uint64_t *data_cells, uint64_t first, uint64_t count) {
+    for (uint64_t end = first + count; first < end;) {
+        uint64_t bits = end - first < 64 - (first & 63) ? end - first : 64 - (first & 63);
+        data_cells[first >> 6] |= (bits == 64 ? UINT64_MAX : ((1ULL << bits) - 1)) << (first & 63);
+        first += bits;
+    }
+}
+
+// The slice gets what decode_slice would find, but per run instead of per cell. RAM has to be zeroed,
+// empty cells aren't written, so the pages of a zeroed area are never touched.
+static bool restore_cells(const uint8_t *in, size_t size, uint8_t operand_size, LoadSlice *slice) {
+    uint8_t instruction_size = 1 + operand_size;
+    uint8_t *cells = slice->ram + slice->first_cell * instruction_size;
+    size_t position = 0;
+    for (uint32_t cell = 0; cell < slice->cell_count;) {
+        uint32_t run;
+        if (position == size) return false;
+        uint8_t op_code = in[position++];
+        if (!get_varint(in, size, &position, &run) || run == 0 || run > slice->cell_count - cell) return false;
+        if (op_code == 0) {
+            mark_data_cells(slice->data_cells, slice->first_cell + cell, run);
+        } else if (op_code >= OPCODE_COUNT || !INSTRUCTION_SET[op_code]) {
+            if (slice->unknown_opcodes == 0) slice->first_unknown = slice->first_cell + cell;
+            slice->unknown_opcodes += run;
+        }
+        for (uint32_t end = cell + run; cell < end; cell++) {
+            uint32_t zigzag = position < size ? in[position] : 0x80;
+            if (zigzag < 0x80) {
+                position++; // Most operands are small
+            } else if (!get_varint(in, size, &position, &zigzag)) {
+                return false;
+            }
+            if (zigzag == 0 && op_code == 0) continue;
+            uint32_t operand = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+            uint8_t *target = cells + (uint64_t)cell * instruction_size;
+            target[0] = op_code;
+            for (uint8_t byte = 0; byte < operand_size; byte++) {
+                target[1 + byte] = (uint8_t)(operand >> (8 * byte));
+            }
+        }
+    }
+    return position == size;
+}
+
+static uint32_t read_u32(const uint8_t *in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(uint32_t));
+    return value;
+}
+
+static size_t put_lz_length(uint8_t *out, size_t length) {
+    size_t size = 0;
+    for (; length >= 255; length -= 255) {
+        out[size++] = 255;
+    }
+    out[size++] = (uint8_t)length;
+    return size;
+}
+
+// A sequence is a token (literal count, match length - PACKED_MIN_MATCH), longer counts continue in bytes of 255,
+// the literals, then a 16 bit offset back into the output. The last sequence has literals only.
+static size_t put_lz_sequence(uint8_t *out, const uint8_t *literals, size_t literal_count, size_t offset, size_t match_length) {
+    size_t size = 1;
+    size_t match_extra = match_length ? match_length - PACKED_MIN_MATCH : 0;
+    out[0] = (uint8_t)((literal_count < 15 ? literal_count : 15) << 4 | (match_extra < 15 ? match_extra : 15));
+    if (literal_count >= 15) size += put_lz_length(out + size, literal_count - 15);
+    memcpy(out + size, literals, literal_count);
+    size += literal_count;
+    if (match_length) {
+        out[size++] = (uint8_t)offset;
+        out[size++] = (uint8_t)(offset >> 8);
+        if (match_extra >= 15) size += put_lz_length(out + size, match_extra - 15);
+    }
+    return size;
+}
+
+static size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out) {
+    uint32_t positions[1 << PACKED_HASH_BITS] = {0}; // Last position + 1 of each hashed 4 byte sequence
+    size_t packed = 0, anchor = 0, position = 0;
+    while (position + PACKED_MIN_MATCH <= size) {
+        uint32_t sequence = read_u32(in + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - PACKED_HASH_BITS);
+        size_t candidate = positions[hash];
+        positions[hash] = (uint32_t)position + 1;
+        if (!candidate || position - (candidate - 1) > UINT16_MAX || read_u32(in + candidate - 1) != sequence) {
+            position++;
+            continue;
+        }
+        size_t match = candidate - 1, length = PACKED_MIN_MATCH;
+        while (position + length < size && in[match + length] == in[position + length]) length++;
+        packed += put_lz_sequence(out + packed, in + anchor, position - anchor, position - match, length);
+        position += length;
+        anchor = position;
+    }
+    return packed + put_lz_sequence(out + packed, in + anchor, size - anchor, 0, 0);
+}
+
+static bool get_lz_length(const uint8_t *in, size_t size, size_t *position, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*position == size) return false;
+        byte = in[(*position)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+static bool lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t out_size) {
+    size_t position = 0, written = 0;
+    while (position < size) {
+        uint8_t token = in[position++];
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !get_lz_length(in, size, &position, &literal_count)) return false;
+        if (literal_count > size - position || literal_count > out_size - written) return false;
+        memcpy(out + written, in + position, literal_count);
+        position += literal_count;
+        written += literal_count;
+        if (position == size) break;
+
+        if (size - position < 2) return false;
+        size_t offset = in[position] | (size_t)in[position + 1] << 8;
+        position += 2;
+        size_t length = token & 15;
+        if (length == 15 && !get_lz_length(in, size, &position, &length)) return false;
+        length += PACKED_MIN_MATCH;
+        if (offset == 0 || offset > written || length > out_size - written) return false;
+        // An overlapping match repeats the last offset bytes, every copy doubles the distance it can copy from
+        for (size_t distance = offset, end = written + length; written < end; distance <<= 1) {
+            size_t chunk = end - written < distance ? end - written : distance;
+            memcpy(out + written, out + written - distance, chunk);
+            written += chunk;
+        }
+    }
+    return written == out_size;
+}
+
+static bool is_block_valid(const PackedBlock *block, uint64_t cells_left, uint8_t instruction_size) {
+    if (block->cell_count == 0 || block->cell_count > PACKED_BLOCK_CELLS || block->cell_count > cells_left) {
+        return false;
+    } else if (block->transformed_size == 0) {
+        return block->packed_size == block->cell_count * instruction_size;
+    }
+    return block->transformed_size <= get_transformed_bound(block->cell_count)
+           && block->packed_size <= get_lz_bound(block->transformed_size);
+}
+
+// Returns the size of the written file, exits when it can't be written
+uint64_t write_packed_image(const char *path, const uint8_t *ram, uint64_t cell_count, uint8_t operand_size, uint32_t memory_size) {
+    uint8_t instruction_size = 1 + operand_size;
+    size_t max_transformed = get_transformed_bound(PACKED_BLOCK_CELLS);
+    uint8_t *transformed = malloc(max_transformed);
+    uint8_t *packed = malloc(get_lz_bound(max_transformed));
+    FILE *file = transformed && packed ? fopen(path, "wb") : NULL;
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t version = PACKED_VERSION;
+    fwrite(PACKED_MAGIC, 1, 4, file);
+    fwrite(&version, 1, 1, file);
+    fwrite(&operand_size, sizeof(uint8_t), 1, file);
+    fwrite(&memory_size, sizeof(uint32_t), 1, file);
+    fwrite(&cell_count, sizeof(uint64_t), 1, file);
+    for (uint64_t first = 0; first < cell_count; first += PACKED_BLOCK_CELLS) {
+        const uint8_t *cells = ram + first * instruction_size;
+        PackedBlock block = {0};
+        block.cell_count = cell_count - first < PACKED_BLOCK_CELLS ? (uint32_t)(cell_count - first) : PACKED_BLOCK_CELLS;
+        block.transformed_size = (uint32_t)transform_cells(cells, block.cell_count, operand_size, transformed);
+        block.packed_size = (uint32_t)lz_compress(transformed, block.transformed_size, packed);
+        block.checksum = get_block_checksum(cells, (size_t)block.cell_count * instruction_size);
+        const uint8_t *payload = packed;
+        if (block.packed_size >= block.transformed_size) { // Nothing repeats, store the runs
+            block.packed_size = block.transformed_size;
+            payload = transformed;
+        }
+        if (block.packed_size >= block.cell_count * instruction_size) { // The runs cost more than the cells
+            block.transformed_size = 0;
+            block.packed_size = block.cell_count * instruction_size;
+            payload = cells;
+        }
+        fwrite(&block, sizeof(PackedBlock), 1, file);
+        fwrite(payload, 1, block.packed_size, file);
+    }
+    free(transformed);
+    free(packed);
+    bool is_written = !ferror(file);
+    long size = ftell(file);
+    if (fclose(file) != 0 || !is_written || size < 0) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return (uint64_t)size;
+}
+
+// Like stream_image, the reader thread reads the next block while this one is decompressed. Every read takes the header
+// of the following block along, so the size of the next read is known as soon as this one is done.
+static uint64_t *unpack_image(FILE *p_file, uint8_t *ram, uint64_t cell_count, uint8_t instruction_size) {
+    uint8_t operand_size = instruction_size - 1;
+    size_t max_transformed = get_transformed_bound(PACKED_BLOCK_CELLS);
+    size_t max_read = get_lz_bound(max_transformed) + sizeof(PackedBlock);
+    uint8_t *buffers[STREAM_WINDOWS];
+    uint8_t *transformed = malloc(max_transformed);
+    bool is_allocated = transformed != NULL;
+    for (uint8_t i = 0; i < STREAM_WINDOWS; i++) {
+        is_allocated = (buffers[i] = malloc(max_read)) && is_allocated;
+    }
+    if (!is_allocated) {
+        perror("Failed to allocate the packed block buffers");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t *data_cells = create_data_cells(cell_count);
+    WindowReader reader;
+    start_window_reader(&reader, p_file);
+    LoadSlice total = {0};
+    PackedBlock block = {0};
+    bool is_valid = cell_count == 0 || (fread(&block, sizeof(PackedBlock), 1, p_file) == 1 && is_block_valid(&block, cell_count, instruction_size));
+    if (is_valid && cell_count > 0) {
+        queue_window_read(&reader, buffers[0], block.packed_size + (block.cell_count < cell_count ? sizeof(PackedBlock) : 0));
+    }
+    uint32_t index = 0;
+    uint64_t first = 0;
+    for (; is_valid && first < cell_count; index++) {
+        WindowRead *read = take_window_read(&reader);
+        uint64_t next = first + block.cell_count;
+        PackedBlock next_block = {0};
+        if (read->bytes_read != read->size) break;
+        if (next < cell_count) {
+            memcpy(&next_block, read->window + block.packed_size, sizeof(PackedBlock));
+            if (!is_block_valid(&next_block, cell_count - next, instruction_size)) break;
+            uint64_t after = next + next_block.cell_count;
+            queue_window_read(&reader, buffers[(index + 1) % STREAM_WINDOWS], next_block.packed_size + (after < cell_count ? sizeof(PackedBlock) : 0));
+        }
+
+        const uint8_t *runs = read->window;
+        if (block.transformed_size != 0 && block.packed_size != block.transformed_size) {
+            is_valid = lz_decompress(read->window, block.packed_size, transformed, block.transformed_size);
+            runs = transformed;
+        }
+        LoadSlice slice = {ram, instruction_size, first, block.cell_count, -1, 0, data_cells, 0, 0, false};
+        if (block.transformed_size == 0) { // Plain cells, decoded like a streamed window
+            memcpy(ram + first * instruction_size, read->window, block.packed_size);
+            decode_slice(&slice);
+        } else {
+            is_valid = is_valid && restore_cells(runs, block.transformed_size, operand_size, &slice);
+        }
+        is_valid = is_valid && get_block_checksum(ram + first * instruction_size, (size_t)block.cell_count * instruction_size) == block.checksum;
+        if (!is_valid) break;
+        merge_slice(&total, &slice);
+        first = next;
+        block = next_block;
+    }
+    stop_window_reader(&reader);
+    for (uint8_t i = 0; i < STREAM_WINDOWS; i++) {
+        free(buffers[i]);
+    }
+    free(transformed);
+    if (first < cell_count) {
+        fprintf(stderr, "Packed block %u (cell %" PRIu64 ") is truncated or corrupt.\n", index, first);
+        free(data_cells);
+        return NULL;
+    } else if (fgetc(p_file) != EOF) {
+        fprintf(stderr, "The packed image continues after its last block.\n");
+        free(data_cells);
+        return NULL;
+    }
+    warn_unknown_opcodes(&total);
+    return data_cells;
+}
+
 uint8_t *read_file(char *absolute_path, Cache *cache, uint64_t *outer_file_size, uint32_t *outer_memory_size, uint8_t *outer_operand_size) {
     FILE *p_file = fopen(absolute_path, "rb");
     if (!p_file) {
@@ -411,14 +2921,21 @@ uint8_t *read_file(char *absolute_path, Cache *cache, uint64_t *outer_file_size,
         exit(EXIT_FAILURE);
     }
 
-    // Read and validate the header
+    // Read and validate the header, a packed image has a version and its cell count around the plain fields
     char magic[5] = {0};
     fread(magic, 1, 4, p_file);
-    if (strcmp(magic, "EMUL") != 0) {
+    bool is_packed = strcmp(magic, PACKED_MAGIC) == 0;
+    uint8_t version = PACKED_VERSION;
+    if (!is_packed && strcmp(magic, "EMUL") != 0) {
         fprintf(stderr, "Invalid magic number: %s\n", magic);
         fclose(p_file);
         free_cache(cache);
         exit(EXIT_FAILURE);
+    } else if (is_packed && (fread(&version, 1, 1, p_file) != 1 || version != PACKED_VERSION)) {
+        fprintf(stderr, "Unsupported packed image version %u, expected %u.\n", version, PACKED_VERSION);
+        fclose(p_file);
+        free_cache(cache);
+        exit(EXIT_FAILURE);
     }
     uint8_t operand_size;
     uint32_t memory_size;
@@ -441,24 +2958,49 @@ uint8_t *read_file(char *absolute_path, Cache *cache, uint64_t *outer_file_size,
     memory_size += 1;  // We want the actual size, not the last idx
     uint8_t instruction_size = 1 + operand_size;
     printf("\nValidatedHeader: Magic=%s, Operand Size=%uB, Memory Size=%uB\n", magic, operand_size, memory_size * instruction_size);
+    uint64_t packed_cells = 0;
+    if (is_packed && fread(&packed_cells, sizeof(uint64_t), 1, p_file) != 1) {
+        fprintf(stderr, "Reached end of file during loading at 0.\n");
+        fclose(p_file);
+        free_cache(cache);
+        exit(EXIT_FAILURE);
+    }
     uint8_t header_size = ftell(p_file);
     fseek(p_file, 0, SEEK_END);
     size_t file_size = ftell(p_file) - header_size;
     fseek(p_file, header_size, SEEK_SET);
+    if (is_packed) { // The size of the cells once unpacked, too many of them fail the checks below
+        file_size = packed_cells > MAX_PROGRAM_SIZE ? SIZE_MAX : packed_cells * instruction_size;
+    }
 
     if (file_size > MAX_PROGRAM_SIZE * instruction_size) {
         fprintf(stderr, "File size exceeds maximum program size of %" PRIu64 "B.\n", MAX_PROGRAM_SIZE * instruction_size);
         fclose(p_file);
         free_cache(cache);
         exit(EXIT_FAILURE);
-    } else if (file_size > memory_size * instruction_size) {
-        fprintf(stderr, "File size exceeds specified memory size of %" PRIu32 "B.\n", memory_size * instruction_size);
+    } else if (file_size > (uint64_t)memory_size * instruction_size) {
+        fprintf(stderr, "File size exceeds specified memory size of %" PRIu64 "B.\n", (uint64_t)memory_size * instruction_size);
         fclose(p_file);
         free_cache(cache);
         exit(EXIT_FAILURE);
     }
 
-    uint8_t *ram = calloc(max_u64((uint64_t)file_size, (uint64_t)(memory_size * instruction_size)), 1);
+    // Whole cells map in place, a file ending inside of a cell goes the buffered way and gets reported there
+    uint64_t ram_size = max_u64((uint64_t)file_size, (uint64_t)memory_size * instruction_size);
+    uint8_t *ram = !is_packed && file_size % instruction_size == 0 ? map_image(fileno(p_file), header_size, file_size, ram_size) : NULL;
+    uint64_t cell_count = file_size / instruction_size;
+    if (ram) {
+        fclose(p_file);
+        // Only the load warm-up reads every cell anyway, otherwise the pages stay where they are until they're used
+        uint64_t *data_cells = cache->warmup == WARMUP_LOAD ? decode_image(ram, cell_count, instruction_size, -1, 0) : NULL;
+        seed_cache(cache, ram, ram_size, (uint32_t)cell_count, instruction_size, data_cells);
+        free(data_cells);
+        printf("File mapped into RAM (%zu bytes).\n", file_size);
+        *outer_file_size = file_size;
+        return ram;
+    }
+
+    ram = calloc(ram_size, 1);
     if (!ram) {
         perror("Failed to allocate RAM");
         fclose(p_file);
@@ -466,124 +3008,143 @@ uint8_t *read_file(char *absolute_path, Cache *cache, uint64_t *outer_file_size,
         exit(EXIT_FAILURE);
     }
 
-    // Buffered reading of file
-    uint32_t instruction_counter = 0;
-    uint32_t temp_u32;
-    int32_t temp_i32;
-    uint8_t op_code;
-    size_t bytes_read, remaining_buffer_size, bytes_to_read;
-    size_t total_size = 0, buffer_pointer = 0;
-    size_t buffer_size = 4096; // Start with a 4 KB buffer
-    uint8_t *buffer = malloc(buffer_size);
-    uint8_t *new_buffer;
-    if (!buffer) {
-        perror("Failed to allocate buffer");
+    if (file_size % instruction_size != 0) {
+        fprintf(stderr, "Reached end of file during loading at %" PRIu64 ".\n", cell_count);
         fclose(p_file);
+        free(ram);
         free_cache(cache);
         exit(EXIT_FAILURE);
     }
-    struct timespec start, end;
-    double io_time = 0, processing_time = 0;
-
-    while (!feof(p_file)) {
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        if (buffer_pointer != total_size) {
-            printf("%zu != %zu\n", buffer_pointer, total_size);
-            remaining_buffer_size = total_size - buffer_pointer;
-            memmove(buffer, buffer + buffer_pointer, remaining_buffer_size);
-        } else {remaining_buffer_size = 0;}
-        bytes_to_read = buffer_size - remaining_buffer_size;
-        bytes_read = fread(buffer + remaining_buffer_size, 1, bytes_to_read, p_file);
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        io_time = elapsed_time(start, end);
-        // printf("%f\n", io_time);
-
-        if (bytes_read == 0) {
-            if (ferror(p_file)) {
-                perror("Error reading file");
-                break;
-            }
-            // EOF reached
-            break;
-        }
-
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        total_size = remaining_buffer_size + bytes_read;
-        buffer_pointer = 0;
-        while (buffer_pointer < total_size) {
-            if (buffer_pointer + 1 > total_size) break; // Ensure opcode fits
-            op_code = buffer[buffer_pointer++];
-            if (buffer_pointer + operand_size > total_size) {
-                buffer_pointer--;
-                break;
-            } // Ensure operand fits
-            temp_u32 = 0;
-            memcpy(&temp_u32, &buffer[buffer_pointer], operand_size);
-            buffer_pointer += operand_size;
-            // printf("u32>%u %d\n", op_code, temp_u32);
-
-            if (op_code == 0) {
-                temp_i32 = temp_u32;
-                // If the operand is signed and operand_size < sizeof(int32_t),
-                // sign-extend the value manually.
-                if (operand_size < sizeof(int32_t) && (temp_i32 & (1 << (8 * operand_size - 1)))) {
-                    temp_i32 |= ~((1 << (8 * operand_size)) - 1); // Sign-extend the value
-                }
-                // printf("i32>%u %d\n", op_code, temp_i32);
-                if ((temp_i32 == 0 && !(will_overwrite_entry(cache, instruction_counter))) 
-                    || temp_i32 != 0) {
-                    bool _;
-                    add_to_cache(cache, instruction_counter, temp_i32, false, &_);
-                }
-            }
-            // Write instruction to RAM
-            // printf("Writing %u %d\n", op_code, temp_u32);
-            memcpy(ram + (instruction_counter * instruction_size), &op_code, 1);
-            memcpy(ram + (instruction_counter * instruction_size) + 1, &temp_u32, operand_size);
-            instruction_counter++;
-            // print_file_in_hex(ram, file_size);
-        }
-
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        processing_time = elapsed_time(start, end);
-        // printf("%f\n", processing_time);
-
-        if (io_time > processing_time && buffer_size < MAX_READ_BUFFER_SIZE) {
-            buffer_size = buffer_size * 2 > MAX_READ_BUFFER_SIZE ? MAX_READ_BUFFER_SIZE : buffer_size * 2;
-            printf("Increasing buffer size to %zu bytes\n", buffer_size);
-            uint8_t *new_buffer = realloc(buffer, buffer_size);
-            if (!new_buffer) {
-                perror("Failed to resize buffer");
-                break;
-            }
-            buffer = new_buffer;
-        } else if (processing_time > io_time && buffer_size > MIN_READ_BUFFER_SIZE) {
-            buffer_size = buffer_size / 2 < MIN_READ_BUFFER_SIZE ? MIN_READ_BUFFER_SIZE : buffer_size / 2;
-            printf("Decreasing buffer size to %zu bytes\n", buffer_size);
-            uint8_t *new_buffer = realloc(buffer, buffer_size);
-            if (!new_buffer) {
-                perror("Failed to resize buffer");
-                break;
-            }
-            buffer = new_buffer;
-        }
-    }
-
-    if (buffer_pointer != total_size) {
-        fprintf(stderr, "Reached end of file during loading at %u.\n", instruction_counter);
-        free(buffer);
-        fclose(p_file);
+    // With pread a large image reads its slices in parallel, anything else streams through a reader thread
+    bool is_sliced = false;
+#ifndef _WIN32
+    is_sliced = !is_packed && get_loader_threads(cell_count) > 1;
+#endif
+    uint64_t *data_cells = is_packed ? unpack_image(p_file, ram, cell_count, instruction_size)
+                           : is_sliced ? decode_image(ram, cell_count, instruction_size, fileno(p_file), header_size)
+                           : stream_image(p_file, ram, cell_count, instruction_size);
+    fclose(p_file);
+    if (!data_cells) {
+        if (!is_packed) perror("Error reading file"); // unpack_image names the broken block
         free(ram);
         free_cache(cache);
         exit(EXIT_FAILURE);
     }
-    free(buffer);
-    fclose(p_file);
-    printf("File loaded into RAM (%zu bytes).\n", file_size);
+    seed_cache(cache, ram, ram_size, (uint32_t)cell_count, instruction_size, data_cells);
+    free(data_cells);
+
+    printf("File %s into RAM (%zu bytes).\n", is_packed ? "unpacked" : "loaded", file_size);
     *outer_file_size = file_size;
     return ram;
 }
 
+void set_cache_warmup(Cache *cache, uint8_t mode, const WarmupProfile *profile) {
+    if (mode > MAX_WARMUP || (mode == WARMUP_PROFILE && !profile)) {
+        fprintf(stderr, "Cache warm-up %u needs a profile.\n", mode);
+        exit(EXIT_FAILURE);
+    }
+    cache->warmup = mode;
+    cache->warmup_profile = profile;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Access count in the upper half, so sorting the pairs orders by count and then by address
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Counts the accesses per address of a trace written with record-trace=
+WarmupProfile *load_warmup_profile(const char *path) {
+    uint32_t *addresses;
+    uint8_t *is_write;
+    uint64_t count = read_trace(path, &addresses, &is_write);
+    free(is_write);
+    qsort(addresses, count, sizeof(uint32_t), compare_u32);
+
+    WarmupProfile *profile = malloc(sizeof(WarmupProfile));
+    uint64_t *counted = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (!profile || !counted) {
+        perror("Failed to allocate memory for the warm-up profile");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t distinct = 0;
+    for (uint64_t i = 0, run = 1; i < count; i++, run++) {
+        if (i + 1 == count || addresses[i + 1] != addresses[i]) {
+            uint64_t accesses = run > UINT32_MAX ? UINT32_MAX : run;
+            counted[distinct++] = (accesses << 32) | addresses[i];
+            run = 0;
+        }
+    }
+    qsort(counted, distinct, sizeof(uint64_t), compare_u64);
+    for (uint32_t i = 0; i < distinct; i++) {
+        addresses[i] = (uint32_t)counted[i]; // Reuse the sorted trace, there are never more addresses than accesses
+    }
+    free(counted);
+    profile->addresses = addresses;
+    profile->count = distinct;
+    printf("Warm-up profile: %u addresses from %" PRIu64 " data accesses\n", distinct, count);
+    return profile;
+}
+
+void free_warmup_profile(WarmupProfile *profile) {
+    if (profile) {
+        free(profile->addresses);
+        free(profile);
+    }
+}
+
+// Installs the hottest data cells of the profile, the hottest last so they win their sets
+static void seed_from_profile(Cache *cache, uint32_t cell_count) {
+    uint32_t capacity = 0;
+    for (const Cache *level = cache; level; level = level->next_level) {
+        capacity += get_word_count(level);
+    }
+    const WarmupProfile *profile = cache->warmup_profile;
+    uint32_t first = profile->count > capacity ? profile->count - capacity : 0;
+    for (uint32_t i = first; i < profile->count; i++) {
+        uint32_t address = profile->addresses[i];
+        if (address >= cell_count || cache->ram[(uint64_t)address * cache->instruction_size] != 0) {
+            continue; // Recorded for another file or no longer a data cell
+        }
+        add_to_cache(cache, address, read_ram_operand(cache, address), false);
+    }
+}
+
+// Fills the cache according to its warm-up mode once RAM is complete, by default with the data cells of the file
+static void seed_data_cell(Cache *cache, const uint8_t *ram, uint32_t address, uint8_t instruction_size) {
+    uint8_t operand_size = instruction_size - 1;
+    uint32_t temp_u32 = 0;
+    memcpy(&temp_u32, ram + ((uint64_t)address * instruction_size) + 1, operand_size);
+    int32_t temp_i32 = sign_extend_i32(temp_u32, operand_size);
+    if ((temp_i32 == 0 && !(will_overwrite_entry(cache, address)))
+        || temp_i32 != 0) {
+        add_to_cache(cache, address, temp_i32, false);
+    }
+}
+
+// data_cells is the bitmap decode_image collected, without it the opcodes are looked at here
+void seed_cache(Cache *cache, uint8_t *ram, uint64_t ram_size, uint32_t cell_count, uint8_t instruction_size, const uint64_t *data_cells) {
+    attach_cache_ram(cache, ram, ram_size, instruction_size);
+    if (cache->warmup == WARMUP_PROFILE) {
+        seed_from_profile(cache, cell_count);
+    }
+    for (uint64_t word = 0; data_cells && cache->warmup == WARMUP_LOAD && word < ((uint64_t)cell_count + 63) >> 6; word++) {
+        for (uint64_t bits = data_cells[word]; bits; bits &= bits - 1) {
+            seed_data_cell(cache, ram, (uint32_t)((word << 6) | __builtin_ctzll(bits)), instruction_size);
+        }
+    }
+    for (uint32_t address = 0; !data_cells && cache->warmup == WARMUP_LOAD && address < cell_count; address++) {
+        if (ram[(uint64_t)address * instruction_size] != 0) continue;
+        seed_data_cell(cache, ram, address, instruction_size);
+    }
+    reset_cache_stats(cache); // Seeding isn't part of the program
+}
+
 // *************************************************
 // Argument parsing & Interrupts
 // *************************************************
@@ -629,6 +3190,61 @@ void strtostr(const char *s, void *output) {
     memcpy((char *)output, s, strlen(s)); // Duplicate the string
 }
 
+void strtopolicy(const char *s, void *output) {
+    for (uint8_t policy = 0; policy <= MAX_POLICY; policy++) {
+        if (strcmp(s, REPLACEMENT_POLICIES[policy]) == 0) {
+            *(uint8_t *)output = policy; // Store the result
+            return;
+        }
+    }
+    fprintf(stderr, "Error: Unknown replacement policy '%s'.\n", s);
+    exit(EXIT_FAILURE);
+}
+
+void strtowritepolicy(const char *s, void *output) {
+    for (uint8_t policy = 0; policy <= MAX_WRITE_POLICY; policy++) {
+        if (strcmp(s, WRITE_POLICIES[policy]) == 0) {
+            *(uint8_t *)output = policy; // Store the result
+            return;
+        }
+    }
+    fprintf(stderr, "Error: Unknown write policy '%s'.\n", s);
+    exit(EXIT_FAILURE);
+}
+
+void strtoprefetcher(const char *s, void *output) {
+    for (uint8_t kind = 0; kind <= MAX_PREFETCHER; kind++) {
+        if (strcmp(s, PREFETCHERS[kind]) == 0) {
+            *(uint8_t *)output = kind; // Store the result
+            return;
+        }
+    }
+    fprintf(stderr, "Error: Unknown prefetcher '%s'.\n", s);
+    exit(EXIT_FAILURE);
+}
+
+void strtopredictor(const char *s, void *output) {
+    for (uint8_t kind = 0; kind <= MAX_PREDICTOR; kind++) {
+        if (strcmp(s, PREDICTORS[kind]) == 0) {
+            *(uint8_t *)output = kind; // Store the result
+            return;
+        }
+    }
+    fprintf(stderr, "Error: Unknown branch predictor '%s'.\n", s);
+    exit(EXIT_FAILURE);
+}
+
+void strtowarmup(const char *s, void *output) {
+    for (uint8_t mode = 0; mode <= MAX_WARMUP; mode++) {
+        if (strcmp(s, WARMUP_MODES[mode]) == 0) {
+            *(uint8_t *)output = mode; // Store the result
+            return;
+        }
+    }
+    fprintf(stderr, "Error: Unknown cache warm-up '%s'.\n", s);
+    exit(EXIT_FAILURE);
+}
+
 int parse_arguments(int argc, char *argv[], ParseableArgument *arguments, int num_arguments) {
     for (int i = 1; i < argc; i++) {
         char *arg = argv[i];
@@ -683,12 +3299,13 @@ int parse_arguments(int argc, char *argv[], ParseableArgument *arguments, int nu
 }
 
 void init_bridge(Bridge *gui_bridge, int32_t *accumulator, uint8_t *instruction_size, uint32_t *instruction_counter, char *instruction, char *coinstruction, char *cocoinstruction, bool *executing, 
-                 bool *single_step_mode, Queue64 *change_queue, Cache *data_cell_cache, Cache *sdata_cell_cache, uint8_t *ram, uint8_t *sram, uint32_t sram_size)
+                 bool *single_step_mode, Queue64 *change_queue, Cache *data_cell_cache, Cache *sdata_cell_cache, uint8_t *ram, uint8_t *sram, uint64_t sram_size)
 {
     gui_bridge->backend_interrupt_code = IC_NOTHING;
     gui_bridge->gui_interrupt_code = IC_NOTHING;
     gui_bridge->new_file_str = NULL;
     gui_bridge->new_cache_bits = 0;
+    gui_bridge->new_cache_rewarm = false;
     gui_bridge->accumulator = accumulator;
     gui_bridge->instruction_size = instruction_size;
     gui_bridge->instruction_counter = instruction_counter;
@@ -701,14 +3318,19 @@ void init_bridge(Bridge *gui_bridge, int32_t *accumulator, uint8_t *instruction_
     gui_bridge->sdata_cell_cache = sdata_cell_cache;
     gui_bridge->sram = sram;
     gui_bridge->sram_size = sram_size;
+    memset(&gui_bridge->cache_counters, 0, sizeof(CacheCounters));
+    gui_bridge->cycles = 0;
+    gui_bridge->timed_instructions = 0;
+    gui_bridge->pipeline = NULL;
+    memset(gui_bridge->cache_opcode_counters, 0, sizeof(gui_bridge->cache_opcode_counters));
     gui_bridge->mutex = malloc(sizeof(mutex_t));
     if (!gui_bridge->mutex) {
         fprintf(stderr, "Failed to allocate memory for gui_bridge mutex\n");
         free_cache(sdata_cell_cache);
         free_cache(data_cell_cache);
         free_queue(change_queue);
-        free(sram);
-        free(ram);
+        free_ram(sram);
+        free_ram(ram);
         exit(EXIT_FAILURE);
     }
     int result = mutex_init(gui_bridge->mutex);
@@ -718,8 +3340,8 @@ void init_bridge(Bridge *gui_bridge, int32_t *accumulator, uint8_t *instruction_
         free_cache(sdata_cell_cache);
         free_cache(data_cell_cache);
         free_queue(change_queue);
-        free(sram);
-        free(ram);
+        free_ram(sram);
+        free_ram(ram);
         exit(EXIT_FAILURE);
     }
 }
@@ -1,36 +1,284 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #include "CTools/treader.h"
+#include "pconstants.h"
 // We only declare what is used outside
 
 // *************************************************
 // Cache
 // *************************************************
 typedef struct {
-    uint64_t *entries; // Cache array, each entry holds an address and operand
+    uint32_t key; // Instruction address and which of its loads
+    uint32_t last_address;
+    int32_t stride;
+    uint8_t confidence;
+} StrideEntry;
+
+typedef struct {
+    uint8_t kind;
+    uint64_t tick; // Data loads so far
+    uint64_t pending_mask; // Cache lines brought in by the prefetcher and not used yet
+    uint64_t issue_ticks[MAX_CACHE_SIZE]; // When each pending line was prefetched
+    StrideEntry stride_table[STRIDE_TABLE_SIZE];
+    uint32_t stream_buffer[STREAM_BUFFER_SIZE]; // Line addresses, the head is the next expected one
+    uint64_t stream_ticks[STREAM_BUFFER_SIZE];
+    uint8_t stream_count;
+    uint64_t issued;
+    uint64_t useful; // Used by a demand load before leaving
+    uint64_t late; // Used before it could have arrived
+    uint64_t polluting; // Thrown away unused
+} Prefetcher;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t compulsory_misses; // First touch of the line
+    uint64_t capacity_misses; // A fully associative LRU cache of the same size misses as well
+    uint64_t conflict_misses; // Only this geometry misses
+    uint64_t dirty_evictions;
+    uint64_t writebacks; // Dirty words handed to the level below
+    uint64_t coherence_misses; // The line was taken away by another hart, not part of the three above
+} CacheCounters;
+
+// Snoop traffic of one private cache
+typedef struct {
+    uint64_t bus_reads; // Read misses broadcast to the other caches
+    uint64_t bus_read_exclusives; // Write misses, the other copies are invalidated
+    uint64_t upgrades; // Writes to a shared line, the other copies are invalidated
+    uint64_t invalidations; // Lines this cache lost to the writes of other harts
+    uint64_t interventions; // Modified lines this cache had to write back for another hart
+} CoherenceCounters;
+
+// Keeps the private caches of several harts coherent with MESI, transactions are serialized like on a snooping bus
+typedef struct CoherenceBus {
+    mutex_t mutex; // Held for a whole miss or upgrade
+    mutex_t *cache_mutexes; // Per hart, held by the hart on a hit and by the snoops of the others
+    struct Cache **caches;
+    uint8_t cache_count;
+} CoherenceBus;
+
+// Data address stream written during execution, one varint per access: zigzag(address delta) << 1 | is_write
+typedef struct {
+    FILE *file;
+    uint32_t last_address;
+    uint64_t records;
+} TraceWriter;
+
+// LRU stack distance of every access: the number of other lines touched since the last access to the same line
+typedef struct {
+    uint64_t *tree; // Fenwick tree over access times, 1 where a line was touched for the last time
+    uint32_t *time_lines; // Line accessed at each time
+    uint64_t capacity; // Access times the tree holds before it is compacted
+    uint64_t time; // Next access time, starts at 1
+    uint64_t *last_times; // Per line of RAM, 0 = never accessed
+    uint64_t line_count;
+    uint64_t distinct_lines;
+    uint64_t histogram[REUSE_HISTOGRAM_SIZE + 1]; // Accesses per distance, the last bucket holds every longer one
+    uint64_t cold_accesses; // First touch of a line, missed by every cache size
+    uint64_t accesses;
+} ReuseAnalyzer;
+
+// Addresses accessed by an earlier run, ordered from the least to the most accessed
+typedef struct {
+    uint32_t *addresses;
+    uint32_t count;
+} WarmupProfile;
+
+typedef struct Cache {
+    // Every line lives in one slot, the slots of a set lie next to each other
+    uint32_t *operands; // One per word
+    uint32_t *tags; // Line address (address >> line_bits) of every slot, searched with SIMD
+    uint64_t valid_mask; // Occupied slots, an empty slot never matches whatever its tag is
+    uint8_t *dirty_masks; // One bit per word of every slot
+    uint8_t *ages; // LRU age of each entry inside of its set (0 = most recently used)
+    uint64_t *set_states; // Per set replacement state (tree-PLRU bits or FIFO pointer)
+    uint32_t random_state; // xorshift32 state for random replacement
     uint8_t size; // Number of entries in the cache
     uint8_t cache_bits;
+    uint8_t ways; // Entries per set, 1 = direct-mapped
+    bool fully_associative; // Single set, the tags live in their own array
+    uint8_t way_bits;
+    uint8_t set_bits; // Bits of the address used for the set index
+    uint8_t line_words; // Cells per line
+    uint8_t line_bits;
+    uint8_t policy;
+    uint16_t last_word; // Word touched by the last find_in_cache/add_to_cache
+    // Backing memory, lines are filled from and written back to it
+    uint8_t *ram;
+    uint64_t ram_size;
+    uint8_t instruction_size;
+    uint64_t evicted[MAX_LINE_WORDS + 1]; // Words written to RAM by the last access, each (address << 32) | operand
+    uint8_t evicted_count;
+    // Hierarchy, misses and write-backs go to the next level instead of RAM
+    struct Cache *next_level; // Owned, freed and duplicated together with this cache
+    struct Cache *upper_level;
+    bool exclusive; // A line lives either here or in the next level, never in both
+    CacheCounters counters;
+    CacheCounters opcode_counters[OPCODE_COUNT]; // Broken down by the instruction that caused them
+    // Shadow fully associative LRU cache of the same size, tells capacity from conflict misses
+    uint32_t shadow_lines[MAX_CACHE_SIZE]; // Most recently used first
+    uint8_t shadow_count;
+    uint64_t *seen_lines; // Bitmap of every line ever touched
+    uint64_t seen_lines_count;
+    // Write policy of the whole hierarchy, kept by the first level
+    uint8_t write_policy;
+    bool write_allocate; // Store misses bring the line in
+    uint64_t *write_buffer; // Coalescing buffer in front of RAM, oldest first, each (address << 32) | operand
+    uint8_t write_buffer_size;
+    uint8_t write_buffer_count;
+    uint64_t ram_writes; // Words that actually reached RAM
+    uint64_t coalesced_writes; // Writes merged into one already waiting in the buffer
+    Prefetcher *prefetcher; // Optional, only on the first level
+    // Extra models on the first level, they see every data access but only count hits and misses
+    struct Cache **shadow_caches; // Owned
+    uint8_t shadow_cache_count;
+    TraceWriter *trace; // Optional, not owned, records the demand accesses of the first level
+    ReuseAnalyzer *reuse; // Optional, only on the first level
+    // MESI between the first levels of several harts: valid lines with dirty words are M, shared ones S, the rest E
+    CoherenceBus *bus; // Optional, not owned
+    uint8_t hart;
+    uint64_t shared_mask;
+    uint64_t *invalidated_lines; // Bitmap of the lines of RAM another hart invalidated here since the last access
+    CoherenceCounters coherence;
+    // How seed_cache fills the hierarchy, kept by the first level
+    uint8_t warmup;
+    const WarmupProfile *warmup_profile; // Not owned, only used by WARMUP_PROFILE
+    // The instruction currently accessing the cache
+    uint32_t access_pc;
+    uint8_t access_opcode;
+    uint8_t access_index; // Loads done by the instruction so far
+    bool is_fetching; // Instruction fetch, counted in fetch_counters instead of by opcode
+    CacheCounters fetch_counters; // Fetches of a unified cache, also part of counters
 } Cache;
 
-Cache *create_cache(uint8_t cache_bits);
+Cache *create_cache(uint8_t cache_bits, uint8_t ways, uint8_t line_words, uint8_t policy);
 void reset_cache(Cache *cache);
 void free_cache(Cache *cache);
+void attach_cache_ram(Cache *cache, uint8_t *ram, uint64_t ram_size, uint8_t instruction_size);
+void attach_next_level(Cache *cache, Cache *next_level, bool exclusive);
+void reset_cache_stats(Cache *cache);
+void set_write_policy(Cache *cache, uint8_t write_policy, bool write_allocate, uint8_t write_buffer_size);
+void set_prefetcher(Cache *cache, uint8_t kind);
+void set_access_context(Cache *cache, uint32_t pc, uint8_t op_code);
+uint8_t create_caches_from_spec(const char *spec, uint8_t line_words, Cache **caches, uint8_t max_caches);
+void add_shadow_caches(Cache *cache, const char *spec);
+bool access_cache_tags(Cache *cache, uint32_t address);
+void record_cache_access(Cache *cache, uint32_t address, bool is_hit);
+bool fetch_instruction(Cache *cache, uint32_t address);
+void print_icache_stats(const Cache *icache);
+void set_reuse_analyzer(Cache *cache, bool enabled);
+void set_cache_warmup(Cache *cache, uint8_t mode, const WarmupProfile *profile);
+WarmupProfile *load_warmup_profile(const char *path);
+void free_warmup_profile(WarmupProfile *profile);
+CoherenceBus *create_coherence_bus(Cache **caches, uint8_t cache_count);
+void free_coherence_bus(CoherenceBus *bus);
+uint32_t coherent_load(Cache *cache, uint32_t address);
+void coherent_store(Cache *cache, uint32_t address, uint32_t operand);
+void print_coherence_stats(const Cache *cache);
+
+// Estimated runtime: every instruction pays the latency of its class, every data access the latencies of the levels it reaches
+typedef struct {
+    uint32_t class_cycles[TIMING_CLASS_COUNT];
+    uint32_t hit_cycles; // L1 lookup, paid by every access
+    uint32_t l2_hit_cycles; // L2 lookup, paid by every L1 miss
+    uint32_t miss_cycles; // Line fetched from RAM
+    uint32_t writeback_cycles; // Word written to RAM
+    uint64_t instructions;
+    uint64_t instruction_cycles;
+    uint64_t data_loads; // Cost the accesses when the cache isn't simulated
+    uint64_t data_stores;
+    uint64_t memory_cycles; // Of the caches already replaced during the run
+    uint64_t fetch_misses; // Of a split I-cache, each line comes from RAM
+} TimingModel;
+
+void init_timing(TimingModel *timing, const char *path);
+void reset_timing(TimingModel *timing);
+void time_instruction(TimingModel *timing, uint8_t op_code);
+void retire_cache_timing(TimingModel *timing, const Cache *cache);
+uint64_t get_cycles(const TimingModel *timing, const Cache *cache);
+void print_timing(const TimingModel *timing, const Cache *cache);
+
+// Outcome of one jump instruction
+typedef struct {
+    uint32_t pc; // UINT32_MAX marks a free slot
+    uint8_t op_code;
+    uint64_t executed;
+    uint64_t taken;
+    uint64_t correct; // The front end fetched the right instruction after it
+} BranchSite;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t history_bits;
+    uint32_t history; // Outcomes of the last conditional jumps, the newest in bit 0
+    uint8_t counters[1 << PREDICTOR_TABLE_BITS]; // 2-bit saturating, taken from 2 on
+    uint32_t btb_pcs[BTB_SIZE]; // UINT32_MAX marks an empty entry
+    uint32_t btb_targets[BTB_SIZE];
+    BranchSite *sites; // Open addressing on the jump address
+    uint32_t site_capacity;
+    uint32_t site_count;
+    uint64_t conditional;
+    uint64_t conditional_correct;
+    uint64_t indirect; // Taken indirect jumps, they need the BTB for their target
+    uint64_t btb_hits; // With the right target
+} BranchPredictor;
+
+BranchPredictor *create_branch_predictor(uint8_t kind, uint8_t history_bits);
+void reset_branch_predictor(BranchPredictor *predictor);
+void free_branch_predictor(BranchPredictor *predictor);
+bool is_predicted_jump(uint8_t op_code);
+bool predict_branch(BranchPredictor *predictor, uint32_t pc, uint8_t op_code, uint32_t next_pc);
+void print_branch_stats(const BranchPredictor *predictor);
+
+// IF/ID/EX/MEM/WB pipeline replayed over the executed instructions, the interpreter stays the functional model
+typedef struct {
+    uint64_t instructions;
+    uint64_t load_use_stalls; // ACC read in EX right behind an instruction that only has it after MEM
+    uint64_t control_stalls; // Wrong-path fetches flushed by taken jumps
+    uint64_t memory_stalls; // Data accesses slower than a cache hit
+    uint64_t execute_stalls; // Multi-cycle MUL_DIR and DIV_DIR
+    uint64_t last_memory_cycles; // Estimate when the previous instruction retired
+    uint64_t last_data_accesses;
+    bool is_acc_late; // The previous instruction writes ACC at the end of MEM
+    uint32_t stage_pcs[PIPELINE_STAGES]; // Instruction in each stage after the last one entered IF
+    BranchPredictor *predictor; // Optional, not owned, without it the front end always fetches the next instruction
+} Pipeline;
+
+void reset_pipeline(Pipeline *pipeline);
+void pipeline_instruction(Pipeline *pipeline, const TimingModel *timing, const Cache *cache, uint32_t pc, uint8_t op_code, uint32_t next_pc);
+uint64_t get_pipeline_cycles(const Pipeline *pipeline);
+void print_pipeline(const Pipeline *pipeline);
+void seed_cache(Cache *cache, uint8_t *ram, uint64_t ram_size, uint32_t cell_count, uint8_t instruction_size, const uint64_t *data_cells);
+void rewarm_cache(Cache *cache, const Cache *previous);
+void move_cache_observers(Cache *to, Cache *from);
+void print_reuse_histogram(const ReuseAnalyzer *reuse, uint8_t line_words);
+bool write_reuse_json(const ReuseAnalyzer *reuse, uint8_t line_words, const char *path);
 bool will_overwrite_entry(Cache *cache, uint32_t address);
 uint64_t find_in_cache(Cache *cache, uint32_t address);
-uint64_t add_to_cache(Cache *cache, uint32_t address, uint32_t operand, bool as_dirty, bool *is_valid_result);
+uint8_t add_to_cache(Cache *cache, uint32_t address, uint32_t operand, bool as_dirty);
+bool store_to_cache(Cache *cache, uint32_t address, uint32_t operand);
 void writeback_cache_entry(Cache *cache, uint8_t *ram, uint64_t cache_entry, uint8_t instruction_size);
 uint32_t get_u32_from_cache_or_ram(Cache *cache, uint8_t *ram, uint32_t address, uint8_t instruction_size);
+bool read_cache_word(const Cache *cache, uint16_t index, uint32_t *address, uint32_t *operand, bool *is_dirty);
 void print_cache(Cache *cache);
+void print_cache_stats(const Cache *cache);
+void print_cache_counters(const char *name, const CacheCounters *counters);
 Cache *duplicate_cache(const Cache *original);
+TraceWriter *open_trace(const char *path);
+void record_trace(TraceWriter *trace, uint32_t address, bool is_write);
+void close_trace(TraceWriter *trace);
+uint64_t read_trace(const char *path, uint32_t **addresses, uint8_t **is_write);
 
 // *************************************************
 // Queue64
 // *************************************************
 typedef struct {
     uint64_t *data;  // Pointer to the queue data
+    uint16_t *slots; // Cache word that accompanies each element
     size_t size;     // Maximum size of the queue
     size_t front;    // Index of the front element
     size_t rear;     // Index of the rear element
@@ -39,6 +287,8 @@ typedef struct {
 
 bool enqueue_with_bit(Queue64 *queue, uint64_t value, bool is_writeback);
 bool dequeue_with_bit(Queue64 *queue, uint64_t *value, bool *is_writeback);
+bool enqueue_with_slot(Queue64 *queue, uint64_t value, bool is_writeback, uint16_t slot);
+bool dequeue_with_slot(Queue64 *queue, uint64_t *value, bool *is_writeback, uint16_t *slot);
 void init_queue(Queue64 *queue, size_t size);
 bool enqueue(Queue64 *queue, uint64_t value);
 bool dequeue(Queue64 *queue, uint64_t *value);
@@ -46,12 +296,17 @@ bool is_empty(const Queue64 *queue);
 bool is_full(const Queue64 *queue);
 void free_queue(Queue64 *queue);
 void reset_queue(Queue64 *queue);
+void flush_cache(Cache *cache, Queue64 *writebacks); // Every word written to RAM is queued as a writeback
 
 // *************************************************
 // Specialized
 // *************************************************
 int32_t sign_extend_i32(int32_t num, uint8_t operand_size);
 uint8_t *read_file(char *absolute_path, Cache *cache, uint64_t *outer_file_size, uint32_t *outer_memory_size, uint8_t *outer_operand_size);
+uint8_t *resize_ram(uint8_t *ram, uint64_t used_size, uint64_t new_size);
+uint8_t *duplicate_ram(const uint8_t *ram, uint64_t size);
+void free_ram(uint8_t *ram);
+uint64_t write_packed_image(const char *path, const uint8_t *ram, uint64_t cell_count, uint8_t operand_size, uint32_t memory_size);
 
 // *************************************************
 // Argument parsing & Interrupts
@@ -68,6 +323,11 @@ void strtou32(const char *s, void *output);
 void strtou8(const char *s, void *output);
 void strtobool(const char *s, void *output);
 void strtostr(const char *s, void *output);
+void strtopolicy(const char *s, void *output);
+void strtowritepolicy(const char *s, void *output);
+void strtoprefetcher(const char *s, void *output);
+void strtowarmup(const char *s, void *output);
+void strtopredictor(const char *s, void *output);
 int parse_arguments(int argc, char *argv[], ParseableArgument *arguments, int num_arguments);
 
 /* Bridge Documentation
@@ -99,6 +359,7 @@ typedef struct { //
     uint8_t gui_interrupt_code; // Backend->Gui
     char *new_file_str; // Accompanies the open_file backend_interrupt_code
     uint8_t new_cache_bits; // Accompanies the change_cache_bits backend_interrupt_code
+    bool new_cache_rewarm; // Also accompanies it, the new cache starts with the lines of the old one
     // Used for per instruction updates
     int32_t *accumulator; // Only view
     uint8_t *instruction_size;
@@ -112,13 +373,20 @@ typedef struct { //
     // Used for reset updates
     Cache *sdata_cell_cache;
     uint8_t *sram; // View into the static ram copy (Not getting modified)
-    uint32_t sram_size;
+    uint64_t sram_size;
+    // Counters of the data cell cache, copied at every STP
+    CacheCounters cache_counters;
+    CacheCounters cache_opcode_counters[OPCODE_COUNT];
+    // Estimated runtime, also copied at every STP
+    uint64_t cycles;
+    uint64_t timed_instructions;
+    const Pipeline *pipeline; // Only in pipeline mode, read live like the accumulator
 
     mutex_t *mutex; // Who is allowed to modify it, read is always allowed
 } Bridge;
 
 void init_bridge(Bridge *gui_bridge, int32_t *accumulator, uint8_t *instruction_size, uint32_t *instruction_counter, char *instruction, char *coinstruction, char *cocoinstruction, bool *executing, 
-                 bool *single_step_mode, Queue64 *change_queue, Cache *data_cell_cache, Cache *sdata_cell_cache, uint8_t *ram, uint8_t *sram, uint32_t sram_size);
+                 bool *single_step_mode, Queue64 *change_queue, Cache *data_cell_cache, Cache *sdata_cell_cache, uint8_t *ram, uint8_t *sram, uint64_t sram_size);
 
 // *************************************************
 // Other
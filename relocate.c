@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <limits.h>
+  #define MAX_PATH PATH_MAX
+#endif
+
+#include "putils.h"
+#include "pconstants.h"
+
+// Moves the data cells of a .p file so the cells used close together in time don't share a set of the
+// direct-mapped data cell cache, the profile is a trace written with record-trace= for the same file
+
+// What the program does with a cell
+#define CELL_DIRECT 1 // Named by the operand of an instruction
+#define CELL_DATA_POINTER 2 // Holds the address used by LDA_IND/STA_IND
+#define CELL_CODE_POINTER 4 // Holds the address used by an indirect jump
+#define CELL_TARGET 8 // A data pointer starts here
+#define CELL_TRACED 16 // Accessed during the profiled run
+#define CELL_PINNED 32 // Stays where it is
+#define CELL_FILLER 64 // Never used, its place can be taken
+
+#define EMPTY_EDGE UINT64_MAX
+
+// Cells that move together, an array keeps its layout so pointer arithmetic over it stays valid
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+    uint64_t accesses;
+    uint32_t new_start;
+} Unit;
+
+// Co-occurrence weights, keyed by (lower cell << 32) | higher cell
+typedef struct {
+    uint64_t *keys;
+    uint64_t *weights;
+    uint64_t capacity;
+    uint64_t count;
+} EdgeTable;
+
+typedef struct {
+    uint8_t *opcodes;
+    uint32_t *operands; // Raw, not sign extended
+    uint8_t *flags;
+    uint32_t cell_count; // Cells in the file
+    uint32_t space; // Addresses the profile and the relocation can touch
+    uint32_t region_start; // First cell after the last instruction, only cells from here on move
+    uint32_t region_end;
+    uint64_t *accesses;
+    // Adjacency of the co-occurrence graph
+    uint64_t *edge_offsets;
+    uint32_t *neighbours;
+    uint64_t *edge_weights;
+    // Placement
+    uint32_t *new_addresses;
+    bool *placed;
+    bool *occupied;
+    uint8_t line_bits;
+    uint32_t set_mask;
+} Relocation;
+
+static bool is_data_operand(uint8_t op_code) {
+    switch (op_code) {
+        case LDA_DIR: case STA_DIR: case ADD_DIR: case SUB_DIR: case MUL_DIR: case DIV_DIR:
+        case LDA_IND: case STA_IND: case JMP_IND: case JNZ_IND: case JZE_IND: case JLE_IND:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_direct_jump(uint8_t op_code) {
+    return op_code == JMP_DIR || op_code == JNZ_DIR || op_code == JZE_DIR || op_code == JLE_DIR;
+}
+
+static void *checked_calloc(size_t count, size_t size, const char *what) {
+    void *memory = calloc(count ? count : 1, size);
+    if (!memory) {
+        fprintf(stderr, "Failed to allocate memory for %s.\n", what);
+        exit(EXIT_FAILURE);
+    }
+    return memory;
+}
+
+// *** Co-occurrence graph ***
+
+static void grow_edges(EdgeTable *table);
+
+static void add_edge(EdgeTable *table, uint32_t a, uint32_t b) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        grow_edges(table);
+    }
+    uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    uint64_t index = (key * 0x9E3779B97F4A7C15ULL) & (table->capacity - 1);
+    while (table->keys[index] != EMPTY_EDGE && table->keys[index] != key) {
+        index = (index + 1) & (table->capacity - 1);
+    }
+    if (table->keys[index] == EMPTY_EDGE) {
+        table->keys[index] = key;
+        table->count++;
+    }
+    table->weights[index]++;
+}
+
+static void grow_edges(EdgeTable *table) {
+    EdgeTable grown = {0};
+    grown.capacity = table->capacity ? table->capacity * 2 : 1024;
+    grown.keys = malloc(grown.capacity * sizeof(uint64_t));
+    grown.weights = checked_calloc(grown.capacity, sizeof(uint64_t), "the co-occurrence graph");
+    if (!grown.keys) {
+        fprintf(stderr, "Failed to allocate memory for the co-occurrence graph.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(grown.keys, 0xFF, grown.capacity * sizeof(uint64_t));
+    for (uint64_t i = 0; i < table->capacity; i++) {
+        if (table->keys[i] == EMPTY_EDGE) continue;
+        uint64_t index = (table->keys[i] * 0x9E3779B97F4A7C15ULL) & (grown.capacity - 1);
+        while (grown.keys[index] != EMPTY_EDGE) {
+            index = (index + 1) & (grown.capacity - 1);
+        }
+        grown.keys[index] = table->keys[i];
+        grown.weights[index] = table->weights[i];
+        grown.count++;
+    }
+    free(table->keys);
+    free(table->weights);
+    *table = grown;
+}
+
+// Temporal relationship graph: every access adds weight towards the cells touched since the last access
+// to the same cell, within a window of twice the cache size, those are the ones that could have evicted it
+static void build_graph(Relocation *relocation, const uint32_t *addresses, uint64_t count, uint32_t window) {
+    EdgeTable table = {0};
+    grow_edges(&table);
+    uint32_t *recent = checked_calloc(window, sizeof(uint32_t), "the co-occurrence window");
+    uint32_t recent_count = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t cell = addresses[i];
+        relocation->accesses[cell]++;
+        relocation->flags[cell] |= CELL_TRACED;
+        uint32_t position = 0;
+        while (position < recent_count && recent[position] != cell) {
+            add_edge(&table, recent[position], cell);
+            position++;
+        }
+        if (position == recent_count && recent_count < window) {
+            recent_count++;
+        } else if (position == recent_count) {
+            position--; // The oldest one falls out of the window
+        }
+        memmove(recent + 1, recent, position * sizeof(uint32_t));
+        recent[0] = cell;
+    }
+    free(recent);
+
+    // Both directions into one adjacency array
+    relocation->edge_offsets = checked_calloc((uint64_t)relocation->space + 1, sizeof(uint64_t), "the co-occurrence graph");
+    for (uint64_t i = 0; i < table.capacity; i++) {
+        if (table.keys[i] == EMPTY_EDGE) continue;
+        relocation->edge_offsets[(table.keys[i] >> 32) + 1]++;
+        relocation->edge_offsets[(uint32_t)table.keys[i] + 1]++;
+    }
+    for (uint32_t cell = 0; cell < relocation->space; cell++) {
+        relocation->edge_offsets[cell + 1] += relocation->edge_offsets[cell];
+    }
+    uint64_t *fill = checked_calloc(relocation->space, sizeof(uint64_t), "the co-occurrence graph");
+    relocation->neighbours = checked_calloc(table.count * 2, sizeof(uint32_t), "the co-occurrence graph");
+    relocation->edge_weights = checked_calloc(table.count * 2, sizeof(uint64_t), "the co-occurrence graph");
+    for (uint64_t i = 0; i < table.capacity; i++) {
+        if (table.keys[i] == EMPTY_EDGE) continue;
+        uint32_t a = table.keys[i] >> 32, b = (uint32_t)table.keys[i];
+        uint64_t slot_a = relocation->edge_offsets[a] + fill[a]++;
+        uint64_t slot_b = relocation->edge_offsets[b] + fill[b]++;
+        relocation->neighbours[slot_a] = b;
+        relocation->edge_weights[slot_a] = table.weights[i];
+        relocation->neighbours[slot_b] = a;
+        relocation->edge_weights[slot_b] = table.weights[i];
+    }
+    free(fill);
+    free(table.keys);
+    free(table.weights);
+}
+
+// *** Program analysis ***
+
+// Finds pointer cells, their initializers and where the data region starts, exits on pointers it can't follow
+static void analyze_program(Relocation *relocation) {
+    uint32_t region_start = 0;
+    for (uint32_t i = 0; i < relocation->cell_count; i++) {
+        if (relocation->opcodes[i] != 0) region_start = i + 1;
+    }
+    relocation->region_start = region_start;
+
+    for (uint32_t i = 0; i < region_start; i++) {
+        uint8_t op_code = relocation->opcodes[i];
+        uint32_t operand = relocation->operands[i];
+        if (!is_data_operand(op_code) || operand >= relocation->space) continue;
+        relocation->flags[operand] |= CELL_DIRECT;
+        if (op_code == LDA_IND || op_code == STA_IND) {
+            relocation->flags[operand] |= CELL_DATA_POINTER;
+        } else if (op_code != LDA_DIR && op_code != STA_DIR && op_code != ADD_DIR && op_code != SUB_DIR && op_code != MUL_DIR && op_code != DIV_DIR) {
+            relocation->flags[operand] |= CELL_CODE_POINTER;
+        }
+    }
+
+    // A data pointer may only be set from an immediate, stepped or copied from another data pointer
+    for (uint32_t i = 0; i < region_start; i++) {
+        uint32_t pointer = relocation->operands[i];
+        if (relocation->opcodes[i] != STA_DIR || pointer >= relocation->space || !(relocation->flags[pointer] & CELL_DATA_POINTER)) {
+            continue;
+        }
+        bool is_followed = false;
+        for (uint32_t j = 0; j < region_start; j++) {
+            if (is_direct_jump(relocation->opcodes[j]) && relocation->operands[j] == i) {
+                fprintf(stderr, "The data pointer store at %u is a jump target, can't tell what it stores into %u.\n", i, pointer);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (i > 0) {
+            uint8_t previous = relocation->opcodes[i - 1];
+            uint32_t source = relocation->operands[i - 1];
+            bool is_source_pointer = source < relocation->space && (relocation->flags[source] & CELL_DATA_POINTER);
+            if (previous == LDA_IMM) {
+                if (source >= region_start && source < relocation->cell_count) {
+                    relocation->flags[source] |= CELL_TARGET;
+                }
+                is_followed = true;
+            } else if ((previous == ADD_DIR || previous == SUB_DIR || previous == LDA_DIR) && is_source_pointer) {
+                is_followed = true;
+            }
+        }
+        if (!is_followed) {
+            fprintf(stderr, "Can't follow the data pointer stored into %u at %u, relocating would break it.\n", pointer, i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Pointers initialized in the image itself
+    for (uint32_t i = region_start; i < relocation->cell_count; i++) {
+        uint32_t value = relocation->operands[i];
+        if ((relocation->flags[i] & CELL_DATA_POINTER) && value >= region_start && value < relocation->cell_count) {
+            relocation->flags[value] |= CELL_TARGET;
+        }
+    }
+}
+
+// Arrays start at a pointer target and run over the traced cells up to the next pointer or target,
+// named cells move alone, the rest either stays or is free space
+static uint32_t build_units(Relocation *relocation, Unit *units) {
+    uint32_t unit_count = 0;
+    uint8_t *flags = relocation->flags;
+    for (uint32_t i = relocation->region_start; i < relocation->cell_count;) {
+        uint32_t length = 1;
+        if (flags[i] & CELL_TARGET) {
+            while (i + length < relocation->cell_count && (flags[i + length] & CELL_TRACED)
+                   && !(flags[i + length] & (CELL_DATA_POINTER | CELL_CODE_POINTER | CELL_TARGET))) {
+                length++;
+            }
+        } else if (!(flags[i] & CELL_DIRECT)) {
+            bool is_used = (flags[i] & CELL_TRACED) || relocation->operands[i] != 0;
+            flags[i] |= is_used ? CELL_PINNED : CELL_FILLER; // Only reachable by pointers we don't know about
+            i++;
+            continue;
+        }
+        Unit *unit = &units[unit_count++];
+        unit->start = i;
+        unit->length = length;
+        unit->accesses = 0;
+        for (uint32_t cell = i; cell < i + length; cell++) {
+            unit->accesses += relocation->accesses[cell];
+        }
+        i += length;
+    }
+    return unit_count;
+}
+
+// *** Placement ***
+
+static uint64_t get_placement_cost(const Relocation *relocation, const Unit *unit, uint32_t start) {
+    uint64_t cost = 0;
+    for (uint32_t i = 0; i < unit->length; i++) {
+        uint32_t cell = unit->start + i, address = start + i;
+        for (uint64_t edge = relocation->edge_offsets[cell]; edge < relocation->edge_offsets[cell + 1]; edge++) {
+            uint32_t other = relocation->neighbours[edge];
+            if (!relocation->placed[other]) continue;
+            uint32_t other_address = relocation->new_addresses[other];
+            bool is_same_set = ((address >> relocation->line_bits) & relocation->set_mask) == ((other_address >> relocation->line_bits) & relocation->set_mask);
+            bool is_same_line = (address >> relocation->line_bits) == (other_address >> relocation->line_bits);
+            cost += is_same_set && !is_same_line ? relocation->edge_weights[edge] : 0;
+        }
+    }
+    return cost;
+}
+
+static bool is_free_span(const Relocation *relocation, const bool *occupied, uint32_t start, uint32_t length) {
+    if (start + length > relocation->region_end) return false;
+    for (uint32_t address = start; address < start + length; address++) {
+        if (occupied[address]) return false;
+    }
+    return true;
+}
+
+// First fit of the arrays still to place, so an early choice never leaves no room for a later one
+static bool do_arrays_fit(const Relocation *relocation, Unit *const *arrays, uint32_t count) {
+    bool *occupied = malloc(relocation->space * sizeof(bool));
+    if (!occupied) {
+        fprintf(stderr, "Failed to allocate memory for the placement.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(occupied, relocation->occupied, relocation->space * sizeof(bool));
+    bool is_fitting = true;
+    for (uint32_t i = 0; i < count && is_fitting; i++) {
+        is_fitting = false;
+        for (uint32_t start = relocation->region_start; start + arrays[i]->length <= relocation->region_end; start++) {
+            if (is_free_span(relocation, occupied, start, arrays[i]->length)) {
+                memset(occupied + start, true, arrays[i]->length);
+                is_fitting = true;
+                break;
+            }
+        }
+    }
+    free(occupied);
+    return is_fitting;
+}
+
+static void place_unit(Relocation *relocation, Unit *unit, uint32_t start) {
+    unit->new_start = start;
+    for (uint32_t i = 0; i < unit->length; i++) {
+        relocation->new_addresses[unit->start + i] = start + i;
+        relocation->placed[unit->start + i] = true;
+        relocation->occupied[start + i] = true;
+    }
+}
+
+static int compare_units(const void *a, const void *b) {
+    const Unit *x = *(Unit *const *)a, *y = *(Unit *const *)b;
+    if ((x->length > 1) != (y->length > 1)) return x->length > 1 ? -1 : 1; // Arrays first, single cells fit anywhere
+    if (x->length > 1 && x->length != y->length) return x->length > y->length ? -1 : 1;
+    if (x->accesses != y->accesses) return x->accesses > y->accesses ? -1 : 1;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Greedy: the hottest unit goes where it shares a set with the least weight of what is already placed
+static void place_units(Relocation *relocation, Unit *units, uint32_t unit_count) {
+    for (uint32_t address = 0; address < relocation->space; address++) {
+        bool is_movable = address >= relocation->region_start && address < relocation->cell_count
+                          && !(relocation->flags[address] & (CELL_PINNED | CELL_FILLER));
+        relocation->new_addresses[address] = address;
+        relocation->placed[address] = !is_movable;
+        // Only pinned cells and everything outside of the region keep their place taken
+        relocation->occupied[address] = address < relocation->region_start || address >= relocation->region_end
+                                        || (relocation->flags[address] & CELL_PINNED);
+    }
+    Unit **order = checked_calloc(unit_count, sizeof(Unit *), "the placement order");
+    uint32_t array_count = 0;
+    for (uint32_t i = 0; i < unit_count; i++) {
+        order[i] = &units[i];
+        array_count += units[i].length > 1;
+    }
+    qsort(order, unit_count, sizeof(Unit *), compare_units);
+    for (uint32_t i = 0; i < unit_count; i++) {
+        Unit *unit = order[i];
+        uint64_t best_cost = UINT64_MAX;
+        uint32_t best_start = 0;
+        for (uint32_t start = relocation->region_start; start + unit->length <= relocation->region_end; start++) {
+            if (!is_free_span(relocation, relocation->occupied, start, unit->length)) continue;
+            uint64_t cost = get_placement_cost(relocation, unit, start);
+            if (cost >= best_cost) continue;
+            if (i + 1 < array_count) {
+                memset(relocation->occupied + start, true, unit->length);
+                bool is_fitting = do_arrays_fit(relocation, order + i + 1, array_count - i - 1);
+                memset(relocation->occupied + start, false, unit->length);
+                if (!is_fitting) continue;
+            }
+            best_cost = cost;
+            best_start = start;
+        }
+        if (best_cost == UINT64_MAX) {
+            fprintf(stderr, "No room left for the cells %u-%u.\n", unit->start, unit->start + unit->length - 1);
+            exit(EXIT_FAILURE);
+        }
+        place_unit(relocation, unit, best_start);
+    }
+    free(order);
+}
+
+// *** Output ***
+
+static uint32_t relocate_address(const Relocation *relocation, uint32_t address) {
+    return address < relocation->space ? relocation->new_addresses[address] : address;
+}
+
+static uint64_t write_relocated_file(const Relocation *relocation, const char *path, uint8_t operand_size, uint32_t memory_size) {
+    uint32_t cell_count = relocation->cell_count;
+    for (uint32_t address = 0; address < relocation->space; address++) {
+        if (relocation->new_addresses[address] + 1 > cell_count && relocation->new_addresses[address] != address) {
+            cell_count = relocation->new_addresses[address] + 1;
+        }
+    }
+    if (cell_count > (uint64_t)memory_size + 1) {
+        fprintf(stderr, "The relocated program needs %u cells, the header only allows %" PRIu64 ".\n", cell_count, (uint64_t)memory_size + 1);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t *opcodes = checked_calloc(cell_count, sizeof(uint8_t), "the relocated program");
+    uint32_t *operands = checked_calloc(cell_count, sizeof(uint32_t), "the relocated program");
+    for (uint32_t i = 0; i < relocation->cell_count; i++) {
+        if (relocation->flags[i] & CELL_FILLER) continue; // Free space is a zero data cell
+        uint32_t target = relocation->new_addresses[i];
+        uint32_t operand = relocation->operands[i];
+        if (i < relocation->region_start && is_data_operand(relocation->opcodes[i])) {
+            operand = relocate_address(relocation, operand);
+        } else if (i < relocation->region_start && relocation->opcodes[i] == LDA_IMM && i + 1 < relocation->region_start
+                   && relocation->opcodes[i + 1] == STA_DIR && relocation->operands[i + 1] < relocation->space
+                   && (relocation->flags[relocation->operands[i + 1]] & CELL_DATA_POINTER)) {
+            operand = relocate_address(relocation, operand); // Pointer initializer
+        } else if (i >= relocation->region_start && (relocation->flags[i] & CELL_DATA_POINTER)
+                   && operand >= relocation->region_start && operand < relocation->cell_count) {
+            operand = relocate_address(relocation, operand);
+        }
+        opcodes[target] = relocation->opcodes[i];
+        operands[target] = operand;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite("EMUL", 1, 4, file);
+    fwrite(&operand_size, sizeof(uint8_t), 1, file);
+    fwrite(&memory_size, sizeof(uint32_t), 1, file);
+    for (uint32_t i = 0; i < cell_count; i++) {
+        fwrite(&opcodes[i], 1, 1, file);
+        fwrite(&operands[i], 1, operand_size, file);
+    }
+    bool is_written = !ferror(file);
+    if (fclose(file) != 0 || !is_written) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    free(opcodes);
+    free(operands);
+    return cell_count;
+}
+
+// Replays the profile on the target geometry before and after moving the cells
+static void print_estimate(const Relocation *relocation, const uint32_t *addresses, uint64_t count, uint8_t cache_bits, uint8_t line_words) {
+    Cache *before = create_cache(cache_bits, 1, line_words, POLICY_LRU);
+    Cache *after = create_cache(cache_bits, 1, line_words, POLICY_LRU);
+    attach_cache_ram(before, NULL, relocation->space, 1);
+    attach_cache_ram(after, NULL, relocation->space, 1);
+    for (uint64_t i = 0; i < count; i++) {
+        access_cache_tags(before, addresses[i]);
+        access_cache_tags(after, relocate_address(relocation, addresses[i]));
+    }
+    print_cache_counters("Before", &before->counters);
+    print_cache_counters("After", &after->counters);
+    free_cache(before);
+    free_cache(after);
+}
+
+int main(int argc, char *argv[]) {
+    char input_path[MAX_PATH] = "";
+    char trace_path[MAX_PATH] = "";
+    char output_path[MAX_PATH] = "";
+    uint8_t cache_bits = 4;
+    uint8_t line_words = 1;
+    uint32_t slack = 0;
+    bool help = false;
+    ParseableArgument arguments[] = {
+        {"help", "h", &help, strtobool, false},
+        {"cache-bits=", "cb=", &cache_bits, strtou8, false},
+        {"line-words=", "lw=", &line_words, strtou8, false},
+        {"trace=", "t=", &trace_path, strtostr, false},
+        {"output=", "o=", &output_path, strtostr, false},
+        {"slack=", "s=", &slack, strtou32, false},
+        {"", "", &input_path, strtostr, false}, // Positional argument
+    };
+    int num_arguments = sizeof(arguments) / sizeof(ParseableArgument);
+    if (parse_arguments(argc, argv, arguments, num_arguments) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
+    if (help || input_path[0] == '\0' || trace_path[0] == '\0' || output_path[0] == '\0') {
+        printf("pasm-relocate Help Menu ~Flags~:\n");
+        printf("  help [h]                           : Opens this menu.\n");
+        printf("  cache-bits [cb]={%u-%u}              : Cache bits of the direct-mapped cache to optimize for, the default is 4.\n", MIN_CACHE_BITS, MAX_CACHE_BITS);
+        printf("  line-words [lw]={%u-%u}              : Cells per cache line, the default is 1.\n", MIN_LINE_WORDS, MAX_LINE_WORDS);
+        printf("  trace [t]={path}                   : Profile of the program written with record-trace=.\n");
+        printf("  output [o]={path}.p                : Where the relocated program is written.\n");
+        printf("  slack [s]={>=0}                    : Extra cells after the end of the file the data may move to, the default is 0.\n");
+        printf("  {positional_arg}.p                 : The program to relocate.\n");
+        return help ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!ends_with(input_path, ".p") || !ends_with(output_path, ".p")) {
+        fprintf(stderr, "Usage: %s [arguments] <file>.p, the output has to end in '.p' as well.\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The model cache stays cold, read_file only has to validate and load the program
+    Cache *cache = create_cache(cache_bits, 1, line_words, POLICY_LRU);
+    set_cache_warmup(cache, WARMUP_COLD, NULL);
+    uint64_t file_size;
+    uint32_t memory_size;
+    uint8_t operand_size;
+    char absolute_path[MAX_PATH];
+    if (realpath(input_path, absolute_path) == NULL) {
+        perror("realpath");
+        return EXIT_FAILURE;
+    }
+    uint8_t *ram = read_file(absolute_path, cache, &file_size, &memory_size, &operand_size);
+    free_cache(cache);
+    uint8_t instruction_size = 1 + operand_size;
+
+    uint32_t *addresses;
+    uint8_t *is_write;
+    uint64_t count = read_trace(trace_path, &addresses, &is_write);
+    free(is_write);
+
+    Relocation relocation = {0};
+    relocation.cell_count = (uint32_t)(file_size / instruction_size);
+    relocation.region_end = relocation.cell_count + slack;
+    relocation.space = relocation.region_end;
+    for (uint64_t i = 0; i < count; i++) {
+        if (addresses[i] >= relocation.cell_count && addresses[i] < relocation.region_end) {
+            fprintf(stderr, "The program uses cell %u after the end of the file, lower the slack.\n", addresses[i]);
+            return EXIT_FAILURE;
+        }
+        if (addresses[i] >= relocation.space) relocation.space = addresses[i] + 1;
+    }
+    relocation.opcodes = checked_calloc(relocation.space, sizeof(uint8_t), "the program");
+    relocation.operands = checked_calloc(relocation.space, sizeof(uint32_t), "the program");
+    relocation.flags = checked_calloc(relocation.space, sizeof(uint8_t), "the cell flags");
+    relocation.accesses = checked_calloc(relocation.space, sizeof(uint64_t), "the access counts");
+    relocation.new_addresses = checked_calloc(relocation.space, sizeof(uint32_t), "the placement");
+    relocation.placed = checked_calloc(relocation.space, sizeof(bool), "the placement");
+    relocation.occupied = checked_calloc(relocation.space, sizeof(bool), "the placement");
+    relocation.line_bits = __builtin_ctz(line_words);
+    relocation.set_mask = (1u << cache_bits) - 1;
+    for (uint32_t i = 0; i < relocation.cell_count; i++) {
+        relocation.opcodes[i] = ram[(uint64_t)i * instruction_size];
+        memcpy(&relocation.operands[i], ram + (uint64_t)i * instruction_size + 1, operand_size);
+    }
+    free_ram(ram);
+
+    build_graph(&relocation, addresses, count, (2u << cache_bits) * line_words);
+    analyze_program(&relocation);
+    Unit *units = checked_calloc(relocation.cell_count, sizeof(Unit), "the units");
+    uint32_t unit_count = build_units(&relocation, units);
+    place_units(&relocation, units, unit_count);
+
+    printf("Data region %u-%u, %u units\n", relocation.region_start, relocation.region_end - 1, unit_count);
+    for (uint32_t i = 0; i < unit_count; i++) {
+        if (units[i].new_start == units[i].start) continue;
+        if (units[i].length > 1) {
+            printf("  %u-%u -> %u-%u (%" PRIu64 " accesses)\n", units[i].start, units[i].start + units[i].length - 1,
+                   units[i].new_start, units[i].new_start + units[i].length - 1, units[i].accesses);
+        } else {
+            printf("  %u -> %u (%" PRIu64 " accesses)\n", units[i].start, units[i].new_start, units[i].accesses);
+        }
+    }
+    print_estimate(&relocation, addresses, count, cache_bits, line_words);
+    uint32_t cell_count = write_relocated_file(&relocation, output_path, operand_size, memory_size);
+    printf("Wrote %u cells to %s\n", cell_count, output_path);
+
+    free(units);
+    free(addresses);
+    free(relocation.opcodes);
+    free(relocation.operands);
+    free(relocation.flags);
+    free(relocation.accesses);
+    free(relocation.edge_offsets);
+    free(relocation.neighbours);
+    free(relocation.edge_weights);
+    free(relocation.new_addresses);
+    free(relocation.placed);
+    free(relocation.occupied);
+    return EXIT_SUCCESS;
+}